@@ -0,0 +1,494 @@
+/*
+ * Please compile using "gcc -std=c99"
+ *
+ * Description: Brute force checker of the routes metroTripPlanner writes with --format csv, for the small networks of
+ * generateNetwork. It walks every route without a loop between the two stations of a trip and compares the best of
+ * them with the routes of the planner.
+ *
+ * Usage:
+ * checkRoutes fastest metro_file queries_file routes_file
+ * checkRoutes alternatives k metro_file queries_file routes_file
+ * checkRoutes pareto metro_file queries_file routes_file
+ *
+ * Routes:
+ * 1. The times are the ones of the metro file alone: the time to reach the next station, the stop time to stay on the
+ *    train, and the transfer time to change lines at a station. The planner's own costs play no part.
+ * 2. A route without a loop starts on any line of the source station and never comes back to a station it has left.
+ *    It can stay on the train or change lines at a station, and it ends on the first arrival at the destination.
+ * 3. The time of a route of the planner is worked out again from its legs: the ride of every leg along its line, and
+ *    the transfer time listed for the line of the next leg at the station where the leg ends. It must be the total the
+ *    planner wrote.
+ *
+ * Checks:
+ * 1. fastest - every trip has one route. No route has as few transfers and is faster, or has fewer transfers and is
+ *    as fast, so it is one of the routes --pareto would give. For the graph, a table or a hierarchy.
+ * 2. alternatives - every trip has up to k different routes without a loop, the first one as for fastest. Every route
+ *    that is faster with as few transfers or as fast with fewer than one of them is one of them too. There are fewer
+ *    than k only if there are no other routes without a loop.
+ * 3. pareto - the routes of a trip are, fastest first, the fastest route for every number of transfers that no route
+ *    with fewer transfers is as fast as: every route that no other route beats as for fastest.
+ * Every trip that differs is written out, and the exit status is 1 if there is one.
+ *
+ */
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+#define NEW_ARRAY(x, n) (x*)calloc((n), sizeof(x))
+
+#define MAX_NAME_LENGTH 100
+#define MAX_TRANSFERS 16 //Routes with 0 to 15 transfers, same as --pareto
+#define MAX_ROUTES 10 //Same as --alternatives
+#define MAX_LEGS 64
+
+//Nodes of a station, as in the planner graph
+#define ARRIVAL(id) (2*(id))
+#define DEPARTURE(id) (2*(id)+1)
+#define STATION_OF_NODE(node) ((node)/2)
+#define IS_ARRIVAL(node) ((node)%2 == 0)
+
+
+/*
+ ********************************************************************************
+ * A station of a line of the metro file. The transfers are read as line names
+ * and times, and turned into the stations of the other lines once all the
+ * lines are read.
+ ********************************************************************************
+ */
+typedef struct {
+  int name;
+  int line;
+  int timeToReach;
+  int stopTime;
+  int numOfTransfers;
+  char (*transferLines)[MAX_NAME_LENGTH];
+  int* transferTimes;
+} CHECKSTATION;
+
+typedef struct {
+  int target;
+  int weight;
+} CHECKEDGE;
+
+//A leg of a route of the planner, as the names of its csv row
+typedef struct {
+  char line[MAX_NAME_LENGTH];
+  char from[MAX_NAME_LENGTH];
+  char to[MAX_NAME_LENGTH];
+  int stations;
+  int rideSeconds;
+} CHECKLEG;
+
+typedef struct {
+  int numOfLegs;
+  CHECKLEG legs[MAX_LEGS];
+  int totalSeconds;
+} CHECKROUTE;
+
+
+/*
+ ********************************************************************************
+ * The network and the search state of the brute force. Every node has its
+ * edges in edges[edgeStart[node]..edgeStart[node+1]). visited marks the names
+ * of the stations the current route went through.
+ ********************************************************************************
+ */
+int numOfStations = 0, numOfNames = 0, numOfLines = 0;
+CHECKSTATION* stations = NULL;
+char (*names)[MAX_NAME_LENGTH] = NULL;
+char (*lineNames)[MAX_NAME_LENGTH] = NULL;
+int* edgeStart = NULL;
+CHECKEDGE* edges = NULL;
+char* visited = NULL;
+
+//Fastest route of the trip being checked for every number of transfers, -1 if there is none
+int bestPerTransfers[MAX_TRANSFERS];
+
+//Routes of the planner for the trip, as times and transfers, and the number of routes of the brute force that are
+//faster with as few transfers or as fast with fewer than each of them
+int plannedTimes[MAX_ROUTES], plannedTransfers[MAX_ROUTES], numOfPlanned = 0;
+int numOfBetter[MAX_ROUTES], numOfLoopless = 0;
+
+
+void stop(char* message, char* fileName) {
+  printf("\n%s %s\n", fileName, message);
+  exit(1);
+}
+
+// Id of a name, added to the table if it is new
+int findName(char (**table)[MAX_NAME_LENGTH], int* count, char* name, int add) {
+  for(int i=0; i<*count; i++)
+    if(strcmp((*table)[i], name) == 0) return i;
+  if(!add) return -1;
+  *table = (char (*)[MAX_NAME_LENGTH]) realloc(*table, MAX_NAME_LENGTH * (*count + 1));
+  strcpy((*table)[*count], name);
+  return (*count)++;
+}
+
+
+/*
+ *****************************************************************
+ * Read the metro file and build the edges of its graph, the same
+ * way as the planner does.
+ *****************************************************************
+ */
+void readMetro(char* fileName) {
+
+  FILE *metro = fopen(fileName, "r");
+  if(metro == NULL) stop("file could not be opened", fileName);
+
+  char row[1024], *tokens[64];
+  int maxStations = 0, line = -1;
+  while(fgets(row, sizeof(row), metro) != NULL) {
+    int n = 0;
+    for(char *token = strtok(row, " \t\r\n"); token != NULL && n < 64; token = strtok(NULL, " \t\r\n")) tokens[n++] = token;
+    if(n == 0) continue;
+    if(n == 2 && tokens[1][0] == '(') {
+      line = findName(&lineNames, &numOfLines, tokens[0], 1);
+      continue;
+    }
+    int transfers = n < 3 || line == -1 ? -1 : atoi(tokens[1]);
+    if(transfers < 0 || (n != 3 + 2*transfers && n != 4 + 2*transfers)) stop("has a station the planner would not read", fileName);
+
+    if(numOfStations == maxStations) {
+      maxStations = maxStations == 0 ? 64 : 2*maxStations;
+      stations = (CHECKSTATION*) realloc(stations, sizeof(CHECKSTATION) * maxStations);
+    }
+    CHECKSTATION *station = &stations[numOfStations++];
+    station->name = findName(&names, &numOfNames, tokens[0], 1);
+    station->line = line;
+    station->timeToReach = atoi(tokens[2]);
+    station->stopTime = n == 4 + 2*transfers ? atoi(tokens[3]) : 0;
+    station->numOfTransfers = transfers;
+    station->transferLines = (char (*)[MAX_NAME_LENGTH]) malloc(MAX_NAME_LENGTH * (transfers + 1));
+    station->transferTimes = NEW_ARRAY(int, transfers + 1);
+    for(int t=0; t<transfers; t++) {
+      snprintf(station->transferLines[t], MAX_NAME_LENGTH, "%s", tokens[n - 2*transfers + 2*t]);
+      station->transferTimes[t] = atoi(tokens[n - 2*transfers + 2*t + 1]);
+    }
+  }
+  fclose(metro);
+
+  //Ride to the next and previous stations of the line, dwell, and change to a line listed with the same station
+  size_t maxEdges = (size_t) numOfStations * 2;
+  int numOfEdges = 0;
+  for(int id=0; id<numOfStations; id++) maxEdges += 1 + (size_t) stations[id].numOfTransfers;
+  edges = NEW_ARRAY(CHECKEDGE, maxEdges);
+  edgeStart = NEW_ARRAY(int, 2*numOfStations + 1);
+  for(int id=0; id<numOfStations; id++) {
+    CHECKSTATION *station = &stations[id];
+    edgeStart[ARRIVAL(id)] = numOfEdges;
+    edges[numOfEdges++] = (CHECKEDGE) {DEPARTURE(id), station->stopTime};
+    for(int t=0; t<station->numOfTransfers; t++) {
+      int other = findName(&lineNames, &numOfLines, station->transferLines[t], 0);
+      for(int to=0; other != -1 && to<numOfStations; to++) {
+        if(stations[to].line == other && stations[to].name == station->name)
+          edges[numOfEdges++] = (CHECKEDGE) {DEPARTURE(to), station->transferTimes[t]};
+      }
+    }
+    edgeStart[DEPARTURE(id)] = numOfEdges;
+    if(id > 0 && stations[id-1].line == station->line)
+      edges[numOfEdges++] = (CHECKEDGE) {ARRIVAL(id-1), station->timeToReach - stations[id-1].timeToReach};
+    if(id+1 < numOfStations && stations[id+1].line == station->line)
+      edges[numOfEdges++] = (CHECKEDGE) {ARRIVAL(id+1), stations[id+1].timeToReach - station->timeToReach};
+  }
+  edgeStart[2*numOfStations] = numOfEdges;
+  visited = NEW_ARRAY(char, numOfNames);
+}
+
+
+// Whether a route is faster with as few transfers or as fast with fewer than another one
+int dominates(int time, int transfers, int otherTime, int otherTransfers) {
+  return time <= otherTime && transfers <= otherTransfers && (time < otherTime || transfers < otherTransfers);
+}
+
+// Keep a route of the brute force: count it, compare it with the routes of the planner, and keep it if it is the
+// fastest for its number of transfers
+void keepRoute(int time, int transfers) {
+  numOfLoopless++;
+  for(int r=0; r<numOfPlanned; r++)
+    if(dominates(time, transfers, plannedTimes[r], plannedTransfers[r])) numOfBetter[r]++;
+  if(transfers < MAX_TRANSFERS && (bestPerTransfers[transfers] == -1 || time < bestPerTransfers[transfers]))
+    bestPerTransfers[transfers] = time;
+}
+
+/*
+ *****************************************************************
+ * Walk every route from node to the first arrival at dest that
+ * enters no station it has been through.
+ *****************************************************************
+ */
+void walkRoutes(int node, int time, int transfers, int dest) {
+  int name = stations[STATION_OF_NODE(node)].name;
+  if(IS_ARRIVAL(node) && name == dest) {
+    keepRoute(time, transfers);
+    return;
+  }
+  for(int e=edgeStart[node]; e<edgeStart[node+1]; e++) {
+    int next = edges[e].target, nextName = stations[STATION_OF_NODE(next)].name;
+    int transfer = IS_ARRIVAL(node) && STATION_OF_NODE(next) != STATION_OF_NODE(node);
+    if(nextName == name) walkRoutes(next, time + edges[e].weight, transfers + transfer, dest);
+    else if(!visited[nextName]) {
+      visited[nextName] = 1;
+      walkRoutes(next, time + edges[e].weight, transfers + transfer, dest);
+      visited[nextName] = 0;
+    }
+  }
+}
+
+void findBestRoutes(int source, int dest) {
+  numOfLoopless = 0;
+  for(int r=0; r<numOfPlanned; r++) numOfBetter[r] = 0;
+  for(int t=0; t<MAX_TRANSFERS; t++) bestPerTransfers[t] = -1;
+  visited[source] = 1;
+  for(int id=0; id<numOfStations; id++)
+    if(stations[id].name == source) walkRoutes(DEPARTURE(id), 0, 0, dest);
+  visited[source] = 0;
+}
+
+
+/*
+ *****************************************************************
+ * Read the routes of the next trip from the csv file into routes.
+ * A trip starts at the first leg of route 1. Returns the number of
+ * routes, -1 at the end of the file and -2 for an error row.
+ *****************************************************************
+ */
+int readTripRoutes(FILE* file, char* row, size_t size, CHECKROUTE routes[]) {
+
+  int numOfRoutes = 0;
+  if(row[0] == '\0' && fgets(row, size, file) == NULL) return -1;
+  do {
+    char *fields[12];
+    int n = 0;
+    for(char *field = row; n < 12; field = strchr(field, ',') + 1) {
+      fields[n++] = field;
+      if(strchr(field, ',') == NULL) break;
+    }
+    if(n < 11 || fields[0][0] == ',') {
+      if(numOfRoutes > 0) return numOfRoutes; //The error is the next trip
+      row[0] = '\0';
+      return -2;
+    }
+    int route = atoi(fields[0]), leg = atoi(fields[1]);
+    if(route == 1 && leg == 1 && numOfRoutes > 0) return numOfRoutes;
+    if(route < 1 || route > MAX_ROUTES || leg < 1 || leg > MAX_LEGS) return -2;
+    if(route > numOfRoutes) numOfRoutes = route;
+    CHECKROUTE *r = &routes[route-1];
+    CHECKLEG *l = &r->legs[leg-1];
+    sscanf(fields[2], "%99[^,]", l->line);
+    sscanf(fields[3], "%99[^,]", l->from);
+    sscanf(fields[4], "%99[^,]", l->to);
+    l->stations = atoi(fields[6]);
+    l->rideSeconds = atoi(fields[7]);
+    int total = atoi(fields[10]);
+    r->totalSeconds = leg == 1 || total == r->totalSeconds ? total : -1; //Every leg has the total of the route
+    r->numOfLegs = leg;
+  } while(fgets(row, size, file) != NULL);
+  row[0] = '\0';
+  return numOfRoutes;
+}
+
+// Id of the station of a name on a line, -1 if the line does not stop there
+int findStation(char* line, char* name) {
+  int lineId = findName(&lineNames, &numOfLines, line, 0), nameId = findName(&names, &numOfNames, name, 0);
+  for(int id=0; lineId != -1 && id<numOfStations; id++)
+    if(stations[id].line == lineId && stations[id].name == nameId) return id;
+  return -1;
+}
+
+/*
+ *****************************************************************
+ * Time of a route of the planner from its legs and the metro file,
+ * or -1 with why in reason if the legs are not a route from source
+ * to dest without a loop. Every leg rides its line from station to
+ * station, with the stops in between, and a leg ending at a station
+ * that lists the line of the next leg changes to it in the transfer
+ * time. visited is clear again when it returns.
+ *****************************************************************
+ */
+int getRouteTime(CHECKROUTE* route, int source, int dest, char** reason) {
+
+  int time = 0, loop = 0;
+  for(int i=0; i<route->numOfLegs; i++) {
+    CHECKLEG *leg = &route->legs[i];
+    int from = findStation(leg->line, leg->from), to = findStation(leg->line, leg->to);
+    if(from == -1 || to == -1 || from == to) {
+      *reason = "a leg that is not a ride on its line";
+      time = -1;
+      break;
+    }
+    int ride = abs(stations[to].timeToReach - stations[from].timeToReach);
+    for(int id = (from < to ? from : to) + 1; id < (from < to ? to : from); id++) ride += stations[id].stopTime;
+    if(ride != leg->rideSeconds || abs(to - from) != leg->stations) {
+      *reason = "a leg with the wrong ride time or number of stations";
+      time = -1;
+      break;
+    }
+    for(int id = i == 0 ? from : from + (from < to ? 1 : -1); ; id += from < to ? 1 : -1) { //The stations it goes through
+      loop |= visited[stations[id].name];
+      visited[stations[id].name] = 1;
+      if(id == to) break;
+    }
+    time += ride;
+    if(i + 1 == route->numOfLegs) break;
+    CHECKLEG *next = &route->legs[i+1];
+    int transfer = -1;
+    if(strcmp(next->from, leg->to) == 0) {
+      for(int t=0; t<stations[to].numOfTransfers; t++)
+        if(strcmp(stations[to].transferLines[t], next->line) == 0) transfer = stations[to].transferTimes[t];
+    }
+    if(transfer == -1) {
+      *reason = "a transfer that the metro file does not list";
+      time = -1;
+      break;
+    }
+    time += transfer;
+  }
+  memset(visited, 0, numOfNames);
+  if(time == -1) return -1;
+  if(loop) {
+    *reason = "a route that comes back to a station";
+    return -1;
+  }
+  if(findName(&names, &numOfNames, route->legs[0].from, 0) != source ||
+     findName(&names, &numOfNames, route->legs[route->numOfLegs-1].to, 0) != dest) {
+    *reason = "a route between other stations";
+    return -1;
+  }
+  if(time != route->totalSeconds) {
+    *reason = "a total that is not the time of its legs";
+    return -1;
+  }
+  return time;
+}
+
+// Whether no route with as few transfers is faster and no route with fewer transfers is as fast
+int isParetoOptimal(int time, int transfers) {
+  if(transfers >= MAX_TRANSFERS || bestPerTransfers[transfers] != time) return 0;
+  for(int t=0; t<transfers; t++)
+    if(bestPerTransfers[t] != -1 && bestPerTransfers[t] <= time) return 0;
+  return 1;
+}
+
+/*
+ *****************************************************************
+ * Whether the routes of the planner are the fastest route for every
+ * number of transfers that no route with fewer transfers is as fast
+ * as, fastest first. MAX_ROUTES of them at most, with the fewest
+ * transfers.
+ *****************************************************************
+ */
+int isParetoFrontier(int found) {
+  int times[MAX_ROUTES], transfers[MAX_ROUTES], numOfRoutes = 0;
+  for(int t=0; t<MAX_TRANSFERS && numOfRoutes < MAX_ROUTES; t++) {
+    if(bestPerTransfers[t] == -1 || (numOfRoutes > 0 && times[numOfRoutes-1] <= bestPerTransfers[t])) continue;
+    times[numOfRoutes] = bestPerTransfers[t];
+    transfers[numOfRoutes++] = t;
+  }
+  if(found != numOfRoutes) return 0;
+  for(int r=0; r<found; r++)
+    if(plannedTimes[r] != times[found-1-r] || plannedTransfers[r] != transfers[found-1-r]) return 0;
+  return 1;
+}
+
+// Whether two routes of the planner take the same lines between the same stations
+int sameRoute(CHECKROUTE* a, CHECKROUTE* b) {
+  if(a->numOfLegs != b->numOfLegs) return 0;
+  for(int i=0; i<a->numOfLegs; i++) {
+    if(strcmp(a->legs[i].line, b->legs[i].line) != 0 || strcmp(a->legs[i].from, b->legs[i].from) != 0 ||
+       strcmp(a->legs[i].to, b->legs[i].to) != 0) return 0;
+  }
+  return 1;
+}
+
+int checkRoutes(char* mode, int k, char* metroFile, char* queriesFile, char* routesFile) {
+
+  readMetro(metroFile);
+  FILE *queries = fopen(queriesFile, "r"), *file = fopen(routesFile, "r");
+  if(queries == NULL) stop("file could not be opened", queriesFile);
+  if(file == NULL) stop("file could not be opened", routesFile);
+
+  static CHECKROUTE routes[MAX_ROUTES];
+  char query[256], row[1024] = "", from[MAX_NAME_LENGTH], to[MAX_NAME_LENGTH];
+  int numOfTrips = 0, numOfFailed = 0;
+  if(fgets(row, sizeof(row), file) == NULL) stop("is empty", routesFile); //The header
+  row[0] = '\0';
+
+  while(fgets(query, sizeof(query), queries) != NULL) {
+    if(sscanf(query, "%99s %99s", from, to) != 2) continue;
+    numOfTrips++;
+    int source = findName(&names, &numOfNames, from, 0), dest = findName(&names, &numOfNames, to, 0);
+    if(source == -1 || dest == -1) stop("has a station that is not in the metro file", queriesFile);
+    int found = readTripRoutes(file, row, sizeof(row), routes);
+    if(found == -1) stop("has fewer trips than the queries", routesFile);
+
+    //The times of the routes of the planner, before the brute force compares its routes with them
+    char *reason = NULL;
+    numOfPlanned = 0;
+    for(int r=0; r<found && reason == NULL; r++) {
+      plannedTimes[r] = getRouteTime(&routes[r], source, dest, &reason);
+      plannedTransfers[r] = routes[r].numOfLegs - 1;
+      for(int other=0; other<r && reason == NULL; other++)
+        if(sameRoute(&routes[r], &routes[other])) reason = "the same route twice";
+      numOfPlanned++;
+    }
+    if(reason != NULL) numOfPlanned = 0;
+    findBestRoutes(source, dest);
+
+    if(found == -2 && numOfLoopless > 0) reason = "no route while there is one";
+    else if(found > k) reason = "too many routes";
+    else if(found > 0 && reason == NULL && strcmp(mode, "pareto") == 0) {
+      if(!isParetoFrontier(found)) reason = "routes that are not the fastest for their transfers";
+    }
+    else if(found > 0 && reason == NULL) {
+      if(!isParetoOptimal(plannedTimes[0], plannedTransfers[0])) reason = "a first route that another route beats";
+      else if(found < k && numOfLoopless != found) reason = "fewer routes than there are";
+    }
+    for(int r=0; r<numOfPlanned && reason == NULL; r++) {
+      int planned = 0;
+      for(int other=0; other<numOfPlanned; other++)
+        planned += dominates(plannedTimes[other], plannedTransfers[other], plannedTimes[r], plannedTransfers[r]);
+      if(numOfBetter[r] != planned) reason = "a route that another route beats is missing";
+    }
+
+    if(reason != NULL) {
+      numOfFailed++;
+      printf("FAIL %s trip %d, %s to %s: %s.", mode, numOfTrips, from, to, reason);
+      for(int r=0; r<found; r++) printf(" %ds/%d", routes[r].totalSeconds, routes[r].numOfLegs - 1);
+      printf(" Fastest for 0 transfers and up:");
+      for(int t=0; t<MAX_TRANSFERS; t++) if(bestPerTransfers[t] != -1) printf(" %ds/%d", bestPerTransfers[t], t);
+      printf("\n");
+    }
+  }
+  fclose(queries);
+  fclose(file);
+  if(numOfFailed == 0) printf("%s: %d trips of %s checked, %s\n", routesFile, numOfTrips, metroFile, mode);
+  return numOfFailed == 0 ? 0 : 1;
+}
+
+
+void printUsage() {
+  printf("\nThe usage is: checkRoutes fastest metro_file queries_file routes_file\n");
+  printf("              checkRoutes alternatives k metro_file queries_file routes_file\n");
+  printf("              checkRoutes pareto metro_file queries_file routes_file\n");
+}
+
+
+int main(int argc, char *argv[]) {
+
+  if(argc == 5 && strcmp(argv[1], "fastest") == 0) return checkRoutes(argv[1], 1, argv[2], argv[3], argv[4]);
+  else if(argc == 5 && strcmp(argv[1], "pareto") == 0) return checkRoutes(argv[1], MAX_ROUTES, argv[2], argv[3], argv[4]);
+  else if(argc == 6 && strcmp(argv[1], "alternatives") == 0) {
+    int k = atoi(argv[2]);
+    if(k < 1 || k > MAX_ROUTES) {
+      printf("\nNeed from 1 to %d alternatives\n", MAX_ROUTES);
+      return 1;
+    }
+    return checkRoutes(argv[1], k, argv[3], argv[4], argv[5]);
+  }
+  printf("\nWrong number of options provided for checkRoutes\n");
+  printUsage();
+  return 1;
+}
@@ -0,0 +1,217 @@
+/*
+ * Please compile using "gcc -std=c99"
+ *
+ * Description: Generator of synthetic metro networks in the format of metro.txt, and of random trips on them, so that
+ * metroTripPlanner can be measured on networks from 10 stations up to a million.
+ *
+ * Usage:
+ * generateNetwork network lines stations_per_line transfer_percent seed network_file
+ * generateNetwork queries metro_file count seed queries_file
+ *
+ * Network:
+ * 1. Line i is named L<i> and its stations S<i>_<j>. The times between two stations are 60 to 240 seconds and the
+ *    stop times 15 to 45 seconds. The first and last stations have no stop time, same as metro.txt.
+ * 2. Every line after the first shares one interchange station with an earlier line, so all the stations are connected.
+ * 3. transfer_percent of the other stations are paired with a station of another line into an interchange named X<k>.
+ *    An interchange lists the other line and a transfer time of 20 to 60 seconds.
+ *
+ * Queries:
+ * count "source destination" pairs of different station names picked from metro_file (metro.txt or a generated file).
+ *
+ */
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+#define NEW_ARRAY(x, n) (x*)calloc((n), sizeof(x))
+
+//Random numbers. xorshift64 so that a seed gives the same network on every platform.
+unsigned long long randomState = 88172645463325252ULL;
+
+unsigned long long nextRandom() {
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 7;
+  randomState ^= randomState << 17;
+  return randomState;
+}
+
+// Random number in [low, high]
+int randomBetween(int low, int high) {
+  return low + (int) (nextRandom() % (unsigned long long) (high - low + 1));
+}
+
+void setSeed(unsigned long long seed) {
+  randomState = 88172645463325252ULL ^ (seed * 0x9E3779B97F4A7C15ULL);
+  if(randomState == 0) randomState = 1;
+  for(int i=0; i<8; i++) nextRandom();
+}
+
+
+/*
+ ********************************************************************************
+ * A generated station. interchange is the number of the interchange the station
+ * is part of, -1 if none. otherLine is the line of the other station of the
+ * interchange.
+ ********************************************************************************
+ */
+typedef struct {
+  int interchange;
+  int otherLine;
+  int transferTime;
+} GENSTATION;
+
+
+/*
+ *****************************************************************
+ * Pair station (a, i) with station (b, j) into interchange k.
+ * Returns 0 if one of them is an interchange already.
+ *****************************************************************
+ */
+int makeInterchange(GENSTATION* stations, int stationsPerLine, int a, int i, int b, int j, int k) {
+  GENSTATION *first = &stations[a*stationsPerLine + i], *second = &stations[b*stationsPerLine + j];
+  if(a == b || first->interchange != -1 || second->interchange != -1) return 0;
+  first->interchange = second->interchange = k;
+  first->otherLine = b;
+  second->otherLine = a;
+  first->transferTime = randomBetween(20, 60);
+  second->transferTime = randomBetween(20, 60);
+  return 1;
+}
+
+
+void generateNetwork(int lines, int stationsPerLine, int transferPercent, char* fileName) {
+
+  FILE *network = fopen(fileName, "w");
+  if(network == NULL) {
+    printf("\n%s file could not be opened\n", fileName);
+    exit(0);
+  }
+
+  GENSTATION *stations = NEW_ARRAY(GENSTATION, (size_t) lines * stationsPerLine);
+  if(stations == NULL) {
+    printf("\nOut of memory\n");
+    exit(0);
+  }
+  for(long s=0; s<(long) lines * stationsPerLine; s++) stations[s].interchange = -1;
+
+  //Connect every line to an earlier one, then add the random interchanges
+  int numOfInterchanges = 0;
+  for(int a=1; a<lines; a++) {
+    int tries = 0;
+    while(!makeInterchange(stations, stationsPerLine, a, randomBetween(0, stationsPerLine-1),
+                           randomBetween(0, a-1), randomBetween(0, stationsPerLine-1), numOfInterchanges)) {
+      if(++tries == 1000) {
+        printf("\nToo few stations per line to connect line %d\n", a);
+        exit(0);
+      }
+    }
+    numOfInterchanges++;
+  }
+  long wanted = (long) lines * stationsPerLine * transferPercent / 200; //Every interchange pairs 2 stations
+  for(long tries=0; lines > 1 && numOfInterchanges < wanted && tries < 4*wanted; tries++) {
+    numOfInterchanges += makeInterchange(stations, stationsPerLine, randomBetween(0, lines-1), randomBetween(0, stationsPerLine-1),
+                                         randomBetween(0, lines-1), randomBetween(0, stationsPerLine-1), numOfInterchanges);
+  }
+
+  for(int a=0; a<lines; a++) {
+    int timeToReach = 0;
+    fprintf(network, "L%d (%d)\n", a, stationsPerLine);
+    for(int i=0; i<stationsPerLine; i++) {
+      GENSTATION *station = &stations[(long) a*stationsPerLine + i];
+      if(i > 0) timeToReach += randomBetween(60, 240);
+
+      if(station->interchange == -1) fprintf(network, "S%d_%d 0 %d", a, i, timeToReach);
+      else fprintf(network, "X%d 1 %d", station->interchange, timeToReach);
+      if(i > 0 && i < stationsPerLine-1) fprintf(network, " %d", randomBetween(15, 45));
+      if(station->interchange != -1) fprintf(network, " L%d %d", station->otherLine, station->transferTime);
+      fprintf(network, "\n");
+    }
+    fprintf(network, "\n");
+  }
+
+  fclose(network);
+  free(stations);
+  printf("%s: %d lines, %ld stations, %d interchanges\n", fileName, lines, (long) lines * stationsPerLine, numOfInterchanges);
+}
+
+
+/*
+ *****************************************************************
+ * Write count random trips between the stations of a metro file.
+ *****************************************************************
+ */
+void generateQueries(char* metroFile, int count, char* fileName) {
+
+  FILE *metro = fopen(metroFile, "r");
+  if(metro == NULL) {
+    printf("\n%s file could not be opened\n", metroFile);
+    exit(0);
+  }
+
+  char row[256], name[100], paren[2];
+  int numOfNames = 0, maxNames = 1024, numOfStations = 0;
+  char **names = (char**) malloc(sizeof(char*) * maxNames);
+
+  //A line row is "name (number of stations)", every other non blank row is a station
+  while(fgets(row, sizeof(row), metro) != NULL) {
+    if(sscanf(row, "%99s %1[(]%d", name, paren, &numOfStations) == 3) continue;
+    if(sscanf(row, "%99s", name) != 1) continue;
+    if(numOfNames == maxNames) {
+      maxNames *= 2;
+      names = (char**) realloc(names, sizeof(char*) * maxNames);
+    }
+    names[numOfNames] = (char*) malloc(strlen(name) + 1);
+    strcpy(names[numOfNames++], name);
+  }
+  fclose(metro);
+  if(numOfNames < 2) {
+    printf("\n%s has fewer than 2 stations\n", metroFile);
+    exit(0);
+  }
+
+  FILE *queries = fopen(fileName, "w");
+  if(queries == NULL) {
+    printf("\n%s file could not be opened\n", fileName);
+    exit(0);
+  }
+  for(int q=0; q<count; q++) {
+    int a = randomBetween(0, numOfNames-1), b = randomBetween(0, numOfNames-1);
+    if(strcmp(names[a], names[b]) == 0) { q--; continue; }
+    fprintf(queries, "%s %s\n", names[a], names[b]);
+  }
+  fclose(queries);
+
+  for(int n=0; n<numOfNames; n++) free(names[n]);
+  free(names);
+  printf("%s: %d trips between the stations of %s\n", fileName, count, metroFile);
+}
+
+
+void printUsage() {
+  printf("\nThe usage is: generateNetwork network lines stations_per_line transfer_percent seed network_file\n");
+  printf("              generateNetwork queries metro_file count seed queries_file\n");
+}
+
+
+int main(int argc, char *argv[]) {
+
+  if(argc == 7 && strcmp(argv[1], "network") == 0) {
+    int lines = atoi(argv[2]), stationsPerLine = atoi(argv[3]), transferPercent = atoi(argv[4]);
+    if(lines < 1 || stationsPerLine < 2 || transferPercent < 0 || transferPercent > 100) {
+      printf("\nNeed at least 1 line, 2 stations per line and a transfer percent from 0 to 100\n");
+      exit(0);
+    }
+    setSeed(strtoull(argv[5], NULL, 10));
+    generateNetwork(lines, stationsPerLine, transferPercent, argv[6]);
+  }
+  else if(argc == 6 && strcmp(argv[1], "queries") == 0) {
+    setSeed(strtoull(argv[4], NULL, 10));
+    generateQueries(argv[2], atoi(argv[3]), argv[5]);
+  }
+  else {
+    printf("\nWrong number of options provided for generateNetwork\n");
+    printUsage();
+  }
+  return 0;
+}
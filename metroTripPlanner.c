@@ -1,56 +1,366 @@
 /*
- * Please compile using "gcc -std=c99" 
+ * Please compile using "gcc -std=c99 -pthread" 
  *
  * Description: This is a program to find the fastest path from source station to destination station in Washington DC metro map.
  *
  * Data Structures Used:
  * 1. LINE - Structure for a line - will have start and end stations along with number of stations on a line.
  * 2. Array of lines (each element is an object of type LINE)
- * 3. STATION - Stations of a line in a linked list 
- * 4. TRANSFERSTATION - Strcuture to hold the transfer station - will have pointer to actual station (of type STATION) which is in the linked list of a line.
- * 5. Array of transfer stations (each element is an object of type TRANSFERSTATION).
+ * 3. STATION - Stations of a line in a linked list
+ * 4. SYMBOLS - Open addressing hash table that gives every station name and line name a dense integer id.
+ *    Names are looked up once per query, after that routing works on the ids only.
+ * 5. GRAPH - Routing graph in compressed sparse row (CSR) form. Every station of every line gets an integer id and two nodes:
+ *    an arrival node (train has just reached the station) and a departure node (rider is on a train about to leave the station).
+ *    The lines, stations and transfers are flat arrays of ids with no pointers, so that --compile can write the whole graph
+ *    to a binary network image and --network can mmap it back and route from it without parsing metro.txt.
+ *    --embed writes the same arrays as static const C tables, and a build with -DEMBEDDED_NETWORK routes from them.
+ *    Every station also keeps a rideClock (timeToReach plus the stops before it on the line), so the time of any ride
+ *    between two stations of a line is two subtractions (RIDE_TIME).
+ * 6. SEARCH - Scratch space for one shortest path search (distances, predecessors, a binary heap and the output file).
+ *    Every thread has its own SEARCH; the GRAPH and TABLE are never written while threads route, so all of them share them.
+ * 7. TABLE - Precomputed travel times and shortest path trees between all the stations, mmap-ed from a binary file.
+ * 8. ARENA - Bump allocator. A GRAPH or TABLE and everything it owns come from one arena and are freed with one call.
+ *    The lines and stations of metro.txt live in a separate arena that is freed as soon as the graph is built.
+ * 9. SCHEDULE - Timetable of --schedule. Every line has a route per direction with the stops in the order the train
+ *    visits them, the arrival and departure offset of every stop from the first one, and the sorted first-stop departure
+ *    times of its trips. Headways are expanded into trips when the schedule is read.
+ * 10. HIERARCHY - Contraction hierarchy of --contract, mmap-ed from a binary file: the rank of every node of the GRAPH and
+ *    its edges to higher ranked nodes, in CSR form, going up from it (forward) and coming down into it (backward). A
+ *    shortcut edge keeps the node it was made for, so it can be unpacked into the edges of the graph.
+ * 11. CACHE - Formatted itineraries of --cache keyed by source, destination and departure time ids, in 16 shards. Every
+ *    shard is a hash table with chained entries and an LRU list behind its own lock.
+ * 12. ALTERNATIVES - Routes and candidates of --alternatives, as runs of nodes in one array with the time at every node.
+ * 13. NAMEINDEX - Trie over the station names folded to lower case with '_' read as a space. The nodes are flat arrays
+ *    in preorder with the children sorted by letter, so the names that start with a text are one run of nodes, in order.
+ * 14. RECORDFILEHEADER, RECORDHEADER, RECORDLEG - Fixed width records of --format binary: a magic and version at the
+ *    start of the file, then a header per route or error and one record per leg with the line and station name ids.
  *
  * Algorithm:
- * 1. Create a graph with all the lines (each line is a linked list) - The TRANSFERSTATION objects provides the connections in the graph.
- * 2. If source and dest are on same line, no need of transfer
- * 3. From the array of transfer stations, we can know at what stations transfer can be done and to what line. 
- * 4. If they are not on same line, find a transfer station on the source line from which we can make a transfer to dest line.
+ * 1. Create a linked list for every line from metro.txt.
+ * 2. Build the routing graph from the lines. There are three kinds of edges:
+ *    a. Ride: departure node of a station -> arrival node of the next/previous station on the line. Weight is the timeToReach delta.
+ *    b. Dwell: arrival node -> departure node of the same station. Weight is the stopTime, paid only when staying on the train.
+ *    c. Transfer: arrival node -> departure node of the same station on another line. Weight is the transferTime.
+ * 3. Run Dijkstra with a binary heap from the departure nodes of the source station (on all its lines) until an arrival node
+ *    of the destination station is settled. The search adds TRANSFER_PENALTY to every transfer edge, so a route does not
+ *    change lines to save a few seconds, and of two routes that cost the same the one with fewer transfers wins. The time
+ *    given for a route is the sum of its weights, without the penalty.
+ * 4. Split the path into legs at the transfer edges and render them once, as text, JSON, CSV or binary records, into
+ *    the record buffer of the search, which is written to the output with one fwrite.
+ * 5. With --precompute, run step 3 from every station and store the times and the predecessors in a table file.
+ *    Queries with --table then only read the table and never touch metro.txt.
+ * 6. With --schedule, run RAPTOR instead of step 3: round k scans every route that serves a station improved in round k-1,
+ *    boards the earliest trip that can still be caught there and rides it, then walks the transfers. After at most
+ *    MAX_RIDES rounds the earliest arrival at the destination and the trips that reach it give the timed legs.
+ * 7. With --contract, contract the nodes of the graph one by one, the ones that add the fewest shortcuts first. A shortcut
+ *    u -> x replaces u -> v -> x when a local search finds no path from u to x as fast without v.
+ *    With --hierarchy, run step 3 from both ends at once, only going up the ranks, and unpack the shortcuts of the path.
+ * 8. With --updates or an "update" line sent to the server, mark closed stations and segments in the graph and set the
+ *    weights of the edges around the changed stations again. Step 3 skips closed edges. The server updates a copy of the
+ *    graph arrays and publishes it, and the queries already running finish on the old ones. Cached trips through the changed
+ *    stations are dropped, or all of them when the update can make some trip faster. A hierarchy or a table is kept as
+ *    long as no update can make a trip faster, and a trip whose path in it goes through a changed station searches the graph.
+ * 9. With --isochrone, run step 3 from the departure nodes of every source in turn with no destination, going on from
+ *    no node whose route is past the cutoff. The first arrival node settled at a station gives its time from that source,
+ *    and the lowest time from all the sources is kept.
+ * 10. With --matrix, search 16 sources at a time with a vector of 16 costs and 16 transfer counts per node. Sweep the
+ *    stations up and down the ids, relaxing the edges of every node that got nearer, until a sweep changes nothing. A line
+ *    is done in one sweep.
+ * 11. With --alternatives k, run Yen's algorithm: every node of the last route found, from where it left the route it
+ *    came from, is a spur. Step 3 runs again from the spur without the next nodes of the routes found so far and
+ *    without the stations before it. The root plus the new path is a candidate, and the fastest candidate is the next route.
+ * 12. With --pareto, run step 3 over labels (node, number of transfers): a transfer edge goes to the next label, and a
+ *    label is dropped when the node has a label as fast with fewer transfers. Every time the destination is settled
+ *    the route is kept and only labels with fewer transfers go on, until a route has no transfer.
+ * 13. A name that is not a station is folded and looked up in the name index: the station with the same folded name,
+ *    else the only station that starts with it, else the only nearest station by edit distance (letters wrong, missing,
+ *    extra or swapped). The edit distance is one row per trie node, filled from the row of its parent, and a subtree
+ *    is skipped when no distance in its row is within the limit. The ids found go to the search as if the name had been
+ *    typed exactly.
+ * 14. On SIGHUP, or with --watch when a network file is written, the server reads the files again in a thread while it
+ *    answers from the old network, applies the "update" lines of the clients to the new one again and publishes it. Every
+ *    search holds a reference to the network it answers from, and the last one frees the old network. The loaders return
+ *    an error on a bad file, and the old network stays.
  *
  */
 
+#define _POSIX_C_SOURCE 200809L //For mmap
+
 #include<stdio.h>
 #include<stdlib.h>
 #include<stdbool.h>
 #include<string.h>
+#include<ctype.h>
+#include<limits.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<errno.h>
+#include<signal.h>
+#include<time.h>
+#include<pthread.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<sys/epoll.h>
+#include<sys/inotify.h>
+#include<sys/resource.h>
 
-#define NUM_OF_LINES 6
 #define NEW(x) (x*)malloc(sizeof(x))
 
+//Nodes of the routing graph. Each station has an arrival node and a departure node.
+#define ARRIVAL(id) (2*(id))
+#define DEPARTURE(id) (2*(id)+1)
+#define STATION_OF_NODE(node) ((node)/2)
+#define IS_ARRIVAL(node) ((node)%2 == 0)
+
+//Station closed by an update, see GRAPH.closed
+#define IS_CLOSED(g, id) ((g)->closed != NULL && ((g)->closed[id] & CLOSED_STATION))
+
+//Time on the train from station a to station b of the same line, with the stops in between but not the ones at a and b.
+//Works on GRAPHSTATION and TABLESTATION, see rideClock.
+#define RIDE_TIME(a, b) ((a)->stationNumber < (b)->stationNumber ? \
+  (b)->rideClock - (a)->rideClock - (a)->stopTime : (a)->rideClock - (b)->rideClock - (b)->stopTime)
+
+//The searches compare routes by their time plus TRANSFER_PENALTY for every transfer, then by their number of transfers,
+//as one cost: COST_SCALE times the first plus the second. A transfer takes only its transferTime while staying on the
+//train takes the stopTime, so without the penalty a route would hop between two lines that share the track at every
+//station to save a few seconds. The penalty is never part of the time given for a route, see ROUTE_TIME.
+//--pareto counts the transfers instead, and a timetable query knows the trains and waits for them.
+#define TRANSFER_PENALTY 120
+#define COST_SCALE 256
+#define TRANSFER_COST (TRANSFER_PENALTY * COST_SCALE + 1)
+#define IS_TRANSFER(from, to) (IS_ARRIVAL(from) && STATION_OF_NODE(to) != STATION_OF_NODE(from))
+#define EDGE_COST(g, node, e) ((g)->edgeWeight[e] * COST_SCALE + (IS_TRANSFER(node, (g)->edgeTarget[e]) ? TRANSFER_COST : 0))
+//Time of a route found at a cost with a number of legs
+#define ROUTE_TIME(cost, numOfLegs) (((cost) - TRANSFER_COST * ((numOfLegs) - 1)) / COST_SCALE)
+
+//Result of a query
+#define QUERY_OK 0
+#define QUERY_SOURCE_NOT_FOUND 1
+#define QUERY_DESTINATION_NOT_FOUND 2
+#define QUERY_NO_PATH 3
+#define QUERY_SAME_STATION 4
+#define QUERY_BAD_LINE 5 //Only in the error records of --format, for a line that is not a query
+
+//Formats of the itineraries (--format)
+#define FORMAT_TEXT 0
+#define FORMAT_JSON 1
+#define FORMAT_CSV 2
+#define FORMAT_BINARY 3
+#define CSV_HEADER "route,leg,line,from,to,towards,stations,ride_seconds,departure,arrival,total_seconds,error\n"
+#define RECORD_MAGIC "MTPR"
+#define RECORD_VERSION 1
+
+//Precomputed table file
+#define TABLE_MAGIC "MTPT"
+#define TABLE_VERSION 3
+
+//Compiled network image
+#define NETWORK_MAGIC "MTPN"
+#define NETWORK_VERSION 2
+
+//Network read when no --metro or --network is given. A kiosk build routes from the tables of metroNetwork.h.
+#ifdef EMBEDDED_NETWORK
+#define DEFAULT_METRO_FILE NULL
+#else
+#define DEFAULT_METRO_FILE "metro.txt"
+#endif
+
+//Contraction hierarchy. A witness search gives up after settling this many nodes and adds the shortcut.
+#define HIERARCHY_MAGIC "MTPH"
+#define HIERARCHY_VERSION 2
+#define WITNESS_LIMIT 500
+
+//Service updates (--updates). A closed edge has the CLOSED weight and is never taken.
+#define CLOSED -1
+#define MAX_WEIGHT 86400 //A day. A network image or table with a longer edge or stop is refused, so that no cost overflows.
+#define CLOSED_STATION 1 //Riders cannot get on, off or change lines there. Trains still run through.
+#define CLOSED_SEGMENT 2 //No trains between the station and the next one on the line
+
+//Query server
+#define MAX_QUERY_LENGTH 256
+
+//What is wrong with a file that could not be loaded
+#define MAX_ERROR_LENGTH 512
+#define MAX_EVENTS 64
+
+//Timetable. A trip with more rides than this is not searched.
+#define MAX_RIDES 12
+#define NO_TIME INT_MAX
+
+//Threaded batch. Queries are read in windows and handed out to the threads in chunks.
+#define BATCH_WINDOW 65536
+#define BATCH_CHUNK 256
+#define OUTPUT_BUFFER (1 << 20) //stdio buffer of the batch output file
+
+//Station name index. "complete" and "match" lines list at most MAX_MATCHES names. A match has at most
+//MAX_EDIT_DISTANCE letters wrong, missing, extra or swapped, or one if the text has SHORT_NAME letters or less.
+#define MAX_MATCHES 10
+#define MAX_EDIT_DISTANCE 2
+#define SHORT_NAME 4
+
+//Result cache (--cache). Every shard has its own lock and LRU list, picked by the hash of the key.
+#define CACHE_SHARDS 16
+
 //File to write the  output to.
 FILE *out;
 
-// Global variables to store the source and destination stations 
-char* sourceName = NULL;
-char* destinationName = NULL;
+//Format of the itineraries and the errors (--format), see writeItinerary. A batch in another format than text writes
+//no blank line after the answers, the server always does so that a client can tell them apart.
+int outputFormat = FORMAT_TEXT;
+bool separateAnswers = true;
+
+/*
+ ********************************************************************************
+ * Phase timers and counters (--stats). Every SEARCH counts its own queries and
+ * adds them to the global stats when it is freed, and a reload of the server
+ * counts its load on its own until the server adds it, so threads never share
+ * them.
+ * Build with -DNO_STATS to compile all of it out.
+ ********************************************************************************
+ */
+#define PHASE_LOAD 0 //Reading metro.txt or mapping a network image or table
+#define PHASE_LOOKUP 1 //Station names to ids
+#define PHASE_ROUTE 2 //Shortest path search, or the table lookup
+#define PHASE_FORMAT 3 //Path and legs of the itinerary
+#define PHASE_OUTPUT 4 //Writing the itinerary
+#define PHASE_QUERY 5 //All of a query
+#define NUM_OF_PHASES 6
+
+#define COUNT_NODES_SETTLED 0
+#define COUNT_EDGES_SCANNED 1
+#define COUNT_HEAP_PUSHES 2
+#define COUNT_HEAP_POPS 3
+#define COUNT_ARENA_ALLOCATIONS 4
+#define COUNT_ARENA_BYTES 5
+#define COUNT_ARENA_BLOCKS 6
+#define COUNT_BYTES_WRITTEN 7
+#define COUNT_CACHE_HITS 8
+#define COUNT_CACHE_MISSES 9
+#define COUNT_CACHE_EVICTIONS 10
+#define NUM_OF_COUNTERS 11
+
+#define NUM_OF_BUCKETS 32 //Histogram bucket b counts the times below 2^b microseconds
+
+typedef struct {
+  double time[NUM_OF_PHASES]; //Microseconds
+  long long calls[NUM_OF_PHASES];
+  long long histogram[NUM_OF_PHASES][NUM_OF_BUCKETS];
+  long long counter[NUM_OF_COUNTERS];
+} STATS;
+
+char* phaseNames[NUM_OF_PHASES] = {"load", "lookup", "route", "format", "output", "query"};
+char* counterNames[NUM_OF_COUNTERS] = {"nodes_settled", "edges_scanned", "heap_pushes", "heap_pops",
+  "arena_allocations", "arena_bytes", "arena_blocks", "bytes_written", "cache_hits", "cache_misses", "cache_evictions"};
+
+STATS stats; //Load and all the freed searches
+
+#ifndef NO_STATS
+#define STAT_START(timer) double timer = getMicroseconds()
+#define STAT_STOP(s, phase, timer) addTime(s, phase, getMicroseconds() - (timer))
+#define STAT_ADD(s, count, n) ((s)->counter[count] += (n))
+#else
+#define STAT_START(timer)
+#define STAT_STOP(s, phase, timer) ((void) (s))
+#define STAT_ADD(s, count, n) ((void) (n))
+#endif
+
+// Monotonic clock in microseconds
+double getMicroseconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+void addTime(STATS* s, int phase, double time) {
+  int bucket = 0;
+  while(bucket < NUM_OF_BUCKETS-1 && time >= (double) (1LL << bucket)) bucket++;
+  s->time[phase] += time;
+  s->calls[phase]++;
+  s->histogram[phase][bucket]++;
+}
+
+void mergeStats(STATS* into, STATS* from) {
+  for(int p=0; p<NUM_OF_PHASES; p++) {
+    into->time[p] += from->time[p];
+    into->calls[p] += from->calls[p];
+    for(int b=0; b<NUM_OF_BUCKETS; b++) into->histogram[p][b] += from->histogram[p][b];
+  }
+  for(int c=0; c<NUM_OF_COUNTERS; c++) into->counter[c] += from->counter[c];
+}
+
+/*
+ *****************************************************************
+ * Write the global stats as one JSON object. Only the non empty
+ * histogram buckets are written, keyed by their upper bound.
+ *****************************************************************
+ */
+void writeStats(FILE* file) {
+#ifdef NO_STATS
+  fprintf(file, "{\"error\": \"built with NO_STATS\"}\n");
+#else
+  fprintf(file, "{\n  \"phases\": {");
+  for(int p=0; p<NUM_OF_PHASES; p++) {
+    fprintf(file, "%s\n    \"%s\": {\"calls\": %lld, \"total_us\": %.1f, \"histogram_us\": {", p ? "," : "",
+      phaseNames[p], stats.calls[p], stats.time[p]);
+    bool first = true;
+    for(int b=0; b<NUM_OF_BUCKETS; b++) {
+      if(stats.histogram[p][b] == 0) continue;
+      fprintf(file, "%s\"<%lld\": %lld", first ? "" : ", ", 1LL << b, stats.histogram[p][b]);
+      first = false;
+    }
+    fprintf(file, "}}");
+  }
+  fprintf(file, "\n  },\n  \"counters\": {");
+  for(int c=0; c<NUM_OF_COUNTERS; c++)
+    fprintf(file, "%s\n    \"%s\": %lld", c ? "," : "", counterNames[c], stats.counter[c]);
+  fprintf(file, "\n  }\n}\n");
+#endif
+}
+
+void writeStatsOnExit() {
+  writeStats(stderr);
+}
+
+/*
+ ********************************************************************************
+ * Arena (bump) allocator. Memory is handed out from big blocks and is only
+ * given back all at once by freeArena. Requests bigger than a block get a
+ * block of their own.
+ ********************************************************************************
+ */
+#define ARENA_BLOCK_SIZE (64*1024)
+
+typedef struct arenaBlock {
+  struct arenaBlock* next;
+  size_t size;
+  size_t used;
+  char data[];
+} ARENABLOCK;
+
+typedef struct {
+  ARENABLOCK* blocks; //Newest block first
+  STATS* stats; //The allocations are counted to, see makeArena
+} ARENA;
 
 //Data structure for each station.
 typedef struct station {
   char* lineName; //the line on which this station is located
   char* stationName;
+  int nameId; //Id of the station name. Fort Totten of green and Fort Totten of red have the same name id.
+  int lineId; //Id of the line, same as its index in the LINE array
+  int id; //Index of the station in the routing graph
   int stationNumber; //Each station in a line is assigned a number
   int numOfTransferLines; //number of other lines a transfer can be done to
   int timeToReach; //Time to reach this station from the first station on this line.
   int stopTime; //Duration for which the train stops on this station.
-  char* transferLines[4]; //To store the transfer lines at a station.
-  int transferTimes[4]; //To store the transfer times at a station.
+  char** transferLines; //To store the transfer lines at a station, numOfTransferLines of them.
+  int* transferTimes; //To store the transfer times at a station.
   struct station* next;
   struct station* prev;
 } STATION;
 
-// Structure object for source and destination stations. Not part of any linked list.
-STATION *source;
-STATION *destination;
-
 /*
  **************************************************************************************
  * Data structure for the line(root) node. The root node has the 
@@ -63,29 +373,546 @@ typedef struct {
   STATION * end;
 }LINE;
 
-LINE* line[6] = {NULL}; //There are 6 lines
+/*
+ ********************************************************************************
+ * Symbol table mapping names to dense ids 0, 1, 2... in the order they were
+ * added. Open addressing with linear probing, the table is kept at most half
+ * full so that a lookup is one or two probes.
+ ********************************************************************************
+ */
+typedef struct {
+  ARENA* arena; //Where the names and the arrays are allocated
+  int numOfNames;
+  int maxNames; //Size of the names array
+  char** names; //Name of every id
+  int capacity; //Number of slots, a power of 2
+  int* slots; //Id stored in every slot, -1 if empty
+} SYMBOLS;
+
 
 /*
  ********************************************************************************
- * Structure to store a transfer station and its properties:
- * 1.Pointer to the transfer station node in the line linked list.
- * 2.Name of the station
- * 3.The current line color. 
+ * Records of the routing graph. They hold ids only, no pointers, so the same
+ * arrays work when they are allocated by buildGraph and when they are mapped
+ * from a network image.
  ********************************************************************************
  */
-typedef struct transferStations {
-  STATION* station; // Pointer to the transfer station in a line  
-  char* stationName;
+typedef struct {
+  int start; //Id of the first station. The stations of a line have consecutive ids.
+  int numOfStations;
+} GRAPHLINE;
+
+typedef struct {
+  int name; //Name id. Fort Totten of green and Fort Totten of red have the same name id.
+  int line;
+  int stationNumber;
+  int timeToReach;
+  int stopTime;
+  int rideClock; //timeToReach plus the stops of all the stations before this one on the line
+  int firstTransfer; //Transfers of the station are transfers[firstTransfer] ... transfers[firstTransfer+numOfTransfers-1]
+  int numOfTransfers;
+} GRAPHSTATION;
+
+typedef struct {
+  int station; //Station id on the other line
+  int transferTime;
+} GRAPHTRANSFER;
+
+/*
+ ********************************************************************************
+ * Routing graph in CSR form. The edges going out of node n are
+ * edgeTarget[edgeStart[n]] ... edgeTarget[edgeStart[n+1]-1] and
+ * their weights (in seconds) are at the same positions in edgeWeight.
+ ********************************************************************************
+ */
+typedef struct {
+  int numOfLines;
+  int numOfStations; //Stations on all the lines. Fort Totten of green and Fort Totten of red are 2 stations.
+  int numOfNames;
+  int numOfTransfers;
+  int numOfNodes;
+  int numOfEdges;
+  GRAPHLINE* lines;
+  GRAPHSTATION* stations;
+  GRAPHTRANSFER* transfers;
+  SYMBOLS* stationNames;
+  SYMBOLS* lineNames;
+  int* nameStart; //Stations with name n are nameStations[nameStart[n]] ... nameStations[nameStart[n+1]-1]
+  int* nameStations;
+  int* edgeStart;
+  int* edgeTarget;
+  int* edgeWeight;
+  ARENA* arena; //Owns the graph and everything it points to, except the image
+  void* map; //Network image the arrays point into, NULL if the graph was built from metro.txt
+  size_t mapSize;
+  bool readOnly; //The arrays are in a network image or compiled in, an update copies them first
+  unsigned char* closed; //CLOSED_STATION and CLOSED_SEGMENT of every station, NULL until the first update
+} GRAPH;
+
+/*
+ ********************************************************************************
+ * Network image (--compile). Every section follows the previous one, all the
+ * ints are native 32 bit ints:
+ * 1. NETWORKHEADER
+ * 2. lines[numOfLines], stations[numOfStations], transfers[numOfTransfers]
+ * 3. nameStart[numOfNames+1], nameStations[numOfStations]
+ * 4. edgeStart[numOfNodes+1], edgeTarget[numOfEdges], edgeWeight[numOfEdges]
+ * 5. stationNameOffsets[numOfNames], lineNameOffsets[numOfLines] - offsets in the string pool
+ * 6. hashSlots[hashCapacity] - slots of the station name SYMBOLS, so lookups need no rebuild
+ * 7. String pool
+ ********************************************************************************
+ */
+typedef struct {
+  char magic[4];
+  int version;
+  int numOfLines;
+  int numOfStations;
+  int numOfNames;
+  int numOfTransfers;
+  int numOfNodes;
+  int numOfEdges;
+  int hashCapacity;
+  int stringPoolSize;
+} NETWORKHEADER;
+
+GRAPH* graph = NULL;
+
+/*
+ ********************************************************************************
+ * Scratch space for Dijkstra. The heap is indexed: heapPos tells where a node
+ * sits in the heap so that its distance can be decreased in place. A search
+ * also carries the file its answers go to and the network it answers from, so
+ * every thread routes with its own SEARCH over a shared network, which is never
+ * written once queries can see it.
+ ********************************************************************************
+ */
+typedef struct search {
+  int* dist; //Best known time to reach each node
+  int* pred; //Previous node on the best path, -1 for the source nodes
+  int* heap;
+  int* heapPos; //Position of each node in the heap, -1 if not in the heap
+  int heapSize;
+  int* touched; //Nodes whose dist was set, so that the next search only resets those
+  int numTouched;
+  int* settled; //Nodes in the order they were taken off the heap
+  int numSettled;
+  int* path; //Nodes of the last path found, from source to destination
+  int pathLength; //0 if the last query found no path or did not make one
+  struct leg* legs; //Legs of the last path found
+  struct raptorSearch* raptor; //Scratch space for timetable queries, NULL if no schedule is loaded
+  struct search* backward; //Backward half of a hierarchy query, made on the first one
+  struct alternatives* alternatives; //Routes of an --alternatives query, made on the first one
+  struct search* labels; //Labels of a --pareto query, PARETO_LABELS per node, made on the first one
+  FILE* capture; //With a cache, the itinerary is written here first so that it can be stored
+  char* captured;
+  size_t capturedSize;
+  FILE* output; //Where the answers are written
+  char* record; //Itinerary being rendered, see writeItinerary
+  size_t recordLength;
+  size_t recordCapacity;
+  STATS stats; //Of the queries answered with this search
+  struct network* network; //Network the queries are answered from, held until the search is freed. NULL for scratch space only.
+} SEARCH;
+
+/*
+ ********************************************************************************
+ * A leg of the journey - ride on one line from a station to another.
+ ********************************************************************************
+ */
+typedef struct leg {
+  int from; //Station id (graph or table) where the leg starts
+  int to;
   char* lineName;
-} TRANSFERSTATION;
+  char* fromStation;
+  char* toStation;
+  char* towards; //Station name towards which the train is headed.
+  int numOfStations;
+  int rideTime; //Time on the train, see RIDE_TIME
+  int departure; //Seconds after midnight, only for timetable queries
+  int arrival;
+} LEG;
+
+/*
+ ********************************************************************************
+ * Precomputed all pairs table (--precompute). The file is written once and is
+ * then mmap-ed by every query process, so they all share the same page cache.
+ * Layout of the file, all the ints are native 32 bit ints:
+ * 1. TABLEHEADER
+ * 2. names[numOfNames] - offset of every station name in the string pool
+ * 3. lines[numOfLines] - TABLELINE for every line
+ * 4. stations[numOfStations] - TABLESTATION for every graph station id
+ * 5. time[numOfNames][numOfNames] - fastest time in seconds, -1 if there is no path
+ * 6. target[numOfNames][numOfNames] - arrival node at the destination on the fastest path
+ * 7. pred[numOfNames][numOfNodes] - shortest path tree of every source (see SEARCH.pred)
+ * 8. String pool
+ ********************************************************************************
+ */
+typedef struct {
+  char magic[4];
+  int version;
+  int numOfNames; //Station names. Fort Totten of green and Fort Totten of red share a name.
+  int numOfLines;
+  int numOfStations;
+  int numOfNodes;
+  int numOfEdges; //Of the graph, with graphHash to catch a graph given for the updates that is not the one of the table
+  unsigned int graphHash;
+  int stringPoolSize;
+} TABLEHEADER;
+
+typedef struct {
+  int name; //Offset of the line name in the string pool
+  int start; //Name of the first station
+  int end; //Name of the last station
+} TABLELINE;
+
+typedef struct {
+  int name;
+  int line;
+  int stationNumber;
+  int stopTime;
+  int rideClock; //See GRAPHSTATION
+} TABLESTATION;
+
+typedef struct {
+  void* map;
+  size_t mapSize;
+  TABLEHEADER* header;
+  int* names;
+  TABLELINE* lines;
+  TABLESTATION* stations;
+  SYMBOLS* symbols; //Index over the station names, built when the table is loaded
+  ARENA* arena;
+  int* time;
+  int* target;
+  int* pred;
+  char* strings;
+} TABLE;
+
+TABLE* table = NULL;
+
+/*
+ ********************************************************************************
+ * Timetable (--schedule). Every line has a route in each direction that has a
+ * schedule. The stops of a route are graph station ids in the order the train
+ * visits them, and its trips are the sorted departure times from the first
+ * stop. All the routes share flat arrays, so a route is scanned as a run of
+ * consecutive ints:
+ *   stops routeStops[firstStop] ... routeStops[firstStop+numOfStops-1]
+ *   arrival/departure offsets (seconds after the trip leaves the first stop)
+ *     at the same positions in arrivalOffset and departureOffset
+ *   trips tripDepartures[firstTrip] ... tripDepartures[firstTrip+numOfTrips-1]
+ ********************************************************************************
+ */
+typedef struct {
+  int line;
+  int firstStop;
+  int numOfStops;
+  int firstTrip;
+  int numOfTrips;
+} ROUTE;
+
+typedef struct {
+  int numOfRoutes;
+  ROUTE* routes;
+  int* lineRoutes; //Route of line l towards its last station is lineRoutes[2*l], towards its first lineRoutes[2*l+1], -1 if none
+  int* routeStops;
+  int* arrivalOffset;
+  int* departureOffset;
+  int* tripDepartures;
+  ARENA* arena;
+} SCHEDULE;
+
+/*
+ ********************************************************************************
+ * Scratch space for RAPTOR. arrival[k*numOfStations + s] is the earliest time
+ * station s can be reached with k rides. How it was reached is in boardStop
+ * and boardTrip at the same position: the route position the ride was boarded
+ * at and the trip taken, or boardTrip -1 and the station walked from for a
+ * transfer.
+ ********************************************************************************
+ */
+typedef struct raptorSearch {
+  int numOfStations;
+  int* arrival;
+  int* boardStop;
+  int* boardTrip;
+  int* best; //Earliest arrival at each station with any number of rides
+  int* marked; //Stations improved in the current round
+  int numMarked;
+  bool* isMarked;
+  int* routeStart; //Earliest position of each queued route, -1 if the route is not queued
+  int* queuedRoutes;
+  int numQueued;
+  int* touched; //Stations whose times were set, so that the next search only resets those
+  int numTouched;
+} RAPTORSEARCH;
+
+/*
+ ********************************************************************************
+ * Scratch space of --alternatives, made on the first query that needs it. The
+ * routes found and the candidates of Yen's algorithm keep their nodes one after
+ * another in nodes, with the time to reach every node at the same position in
+ * times, so a route is a start and a length.
+ ********************************************************************************
+ */
+#define MAX_ALTERNATIVES 10
+
+typedef struct {
+  int start; //Position of the first node in nodes
+  int length;
+  int deviation; //Spur searches of the route start at this node, the ones before were done for its parent
+  bool accepted;
+} ALTPATH;
+
+typedef struct alternatives {
+  int* nodes;
+  int* times;
+  int numOfNodes;
+  int maxNodes;
+  ALTPATH* paths; //Routes accepted and candidates
+  int numOfPaths;
+  int maxPaths;
+  int accepted[MAX_ALTERNATIVES]; //Routes in the order they were accepted, fastest first
+  int numAccepted;
+  int banned[MAX_ALTERNATIVES]; //Nodes the spur search may not go to from the spur node
+  int numBanned;
+  int* nameStamp; //Station names stamped with stamp are off limits to the spur search
+  int* stationStamp; //Stations already listed for the cache
+  int stamp;
+} ALTERNATIVES;
+
+int numOfAlternatives = 1; //Routes written per query, more than 1 with --alternatives
+
+//Multi-criteria search of --pareto. A node has one label per number of transfers, next to each other.
+#define PARETO_LABELS 16 //Routes with 0 to 15 transfers
+#define LABEL(node, transfers) ((node) * PARETO_LABELS + (transfers))
+
+bool pareto = false; //Write the fastest route for every number of transfers that saves time, --pareto
+
+/*
+ ********************************************************************************
+ * Contraction hierarchy (--contract). The nodes of the graph are ranked and
+ * every edge is stored once, at its lower ranked end: forward edges go up from
+ * a node, backward edges come down into it. middle is the node a shortcut was
+ * made for, -1 for an edge of the graph. Layout of the file, all the ints are
+ * native 32 bit ints:
+ * 1. HIERARCHYHEADER
+ * 2. rank[numOfNodes]
+ * 3. forwardStart[numOfNodes+1], forward[numOfForward]
+ * 4. backwardStart[numOfNodes+1], backward[numOfBackward]
+ ********************************************************************************
+ */
+typedef struct {
+  char magic[4];
+  int version;
+  int numOfNodes;
+  int numOfEdges; //Of the graph, with graphHash to catch a hierarchy made for another network
+  unsigned int graphHash;
+  int numOfForward;
+  int numOfBackward;
+} HIERARCHYHEADER;
+
+typedef struct {
+  int node; //Other end of the edge
+  int weight;
+  int middle;
+} HIERARCHYEDGE;
+
+typedef struct {
+  void* map;
+  size_t mapSize;
+  HIERARCHYHEADER* header;
+  int* rank;
+  int* forwardStart;
+  HIERARCHYEDGE* forward;
+  int* backwardStart;
+  HIERARCHYEDGE* backward;
+  unsigned char* changed; //Stations updates slowed down since the file was made, NULL until one does
+} HIERARCHY;
+
+/*
+ ********************************************************************************
+ * Result cache (--cache). Keeps the formatted itinerary of the most recently
+ * asked (source, destination, departure) name ids, so a repeated query skips
+ * routing and formatting. Every shard is a hash table of chained entries and
+ * an LRU list, newest first, behind its own lock. The cache is made when the
+ * network is loaded and freed with it, so it never outlives the network its
+ * ids belong to. A copy of the network for an update gets a copy of it.
+ ********************************************************************************
+ */
+typedef struct cacheEntry {
+  int source;
+  int dest;
+  int departure; //-1 without a schedule
+  int result; //QUERY_OK or QUERY_NO_PATH
+  char* text; //Itinerary, empty for QUERY_NO_PATH
+  size_t length;
+  int* stations; //Graph stations on the path, to drop the entry when an update makes one of them slower
+  int numOfStations;
+  struct cacheEntry* chain; //Next entry in the same bucket
+  struct cacheEntry* newer;
+  struct cacheEntry* older;
+} CACHEENTRY;
+
+typedef struct {
+  pthread_mutex_t lock;
+  CACHEENTRY** buckets;
+  int numOfBuckets; //Power of 2
+  int numOfEntries;
+  int maxEntries;
+  CACHEENTRY* newest;
+  CACHEENTRY* oldest;
+} CACHESHARD;
+
+typedef struct {
+  CACHESHARD shards[CACHE_SHARDS];
+} CACHE;
+
+int cacheEntries = 0; //Size of the cache made with the network, 0 for none
+
+/*
+ ********************************************************************************
+ * Trie over the station names, with the letters in lower case and '_' read as a
+ * space (folded). The nodes are in preorder and the children of a node are
+ * sorted by their letter, so the names that start with the letters down to a
+ * node are at the nodes up to its end, in order, and its next sibling is at its
+ * end. Names that fold the same end at the same node and are chained in sameName.
+ ********************************************************************************
+ */
+typedef struct {
+  SYMBOLS* symbols; //Station names the ids belong to
+  int numOfNodes;
+  char* letters; //Letter on the edge into every node. Node 0 is the root.
+  int* ends; //First node after the subtree of every node
+  int* names; //First name id that ends at every node, -1 if none
+  int* sameName; //Next name id that ends at the same node, -1 if none
+} NAMEINDEX;
+
+pthread_mutex_t nameIndexLock = PTHREAD_MUTEX_INITIALIZER; //Taken to make the name index of a network, see getNameIndex
+
+/*
+ ********************************************************************************
+ * A loaded network: the table, or the graph and what goes with it. Queries are
+ * answered from the one network points to, which is never changed once it is
+ * published: an update makes a copy (see copyNetwork) and a reload reads a new
+ * one, and either is published in its place. Every search answering from a
+ * network holds a reference to it, so a search that started on the old one
+ * finishes on it, and the last reference frees it. The graph and table globals
+ * are the ones of the newest network, for the modes that answer no queries.
+ ********************************************************************************
+ */
+typedef struct network {
+  GRAPH* graph; //With a table, only there to update it, NULL if no metro or network file was given
+  TABLE* table;
+  unsigned char* tableChanged; //Stations updates slowed down since the table was made, NULL until one does
+  SCHEDULE* schedule;
+  HIERARCHY* hierarchy;
+  CACHE* cache;
+  NAMEINDEX* nameIndex; //NULL until getNameIndex makes it
+  struct network* base; //Network this one is a copy of, which owns the parts they share. NULL if it owns all of them.
+  int refs; //Searches answering from it, and one more while it is published
+} NETWORK;
+
+NETWORK* network = NULL;
+pthread_mutex_t networkLock = PTHREAD_MUTEX_INITIALIZER; //Taken to publish a network or to get a reference to it
+
+//State of a fuzzy search of the name index, see matchName
+typedef struct {
+  NAMEINDEX* index;
+  char* text; //Folded
+  int length;
+  int maxDistance;
+  int* rows; //Edit distance between the start of the text and the letters down to a node, a row of length+1 per depth
+  int* ids; //Matches found, nearest first
+  int* distances;
+  int numOfMatches;
+  int maxMatches;
+} NAMEMATCH;
+
+//Edges of a node while the graph is contracted
+typedef struct {
+  HIERARCHYEDGE* edges;
+  int numOfEdges;
+  int maxEdges;
+} EDGELIST;
+
+// Create an empty arena whose allocations are counted to s, the stats of the thread that loads
+ARENA* makeArena(STATS* s) {
+  ARENA *temp;
+  temp = NEW(ARENA);
+  if(temp != NULL) {
+    temp->blocks = NULL;
+    temp->stats = s;
+  }
+  return temp;
+}
+
+/*
+ *************************************************************
+ * Get size bytes from the arena, aligned for any type. Exits
+ * if the memory runs out, same as any other load failure.
+ *************************************************************
+ */
+void* arenaAlloc(ARENA* arena, size_t size) {
+
+  ARENABLOCK *block = arena->blocks;
+  size = (size + 15) & ~(size_t) 15;
+
+  if(block == NULL || block->used + size > block->size) {
+    size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    block = (ARENABLOCK*) malloc(sizeof(ARENABLOCK) + blockSize);
+    if(block == NULL) {
+      printf("\nOut of memory\n");
+      exit(0);
+    }
+    block->size = blockSize;
+    block->used = 0;
+    STAT_ADD(arena->stats, COUNT_ARENA_BLOCKS, 1);
+    //A big request must not waste the rest of the current block, so its block goes second
+    if(blockSize > ARENA_BLOCK_SIZE && arena->blocks != NULL) {
+      block->next = arena->blocks->next;
+      arena->blocks->next = block;
+    }
+    else {
+      block->next = arena->blocks;
+      arena->blocks = block;
+    }
+  }
+  void *memory = block->data + block->used;
+  block->used += size;
+  STAT_ADD(arena->stats, COUNT_ARENA_ALLOCATIONS, 1);
+  STAT_ADD(arena->stats, COUNT_ARENA_BYTES, size);
+  return memory;
+}
+
+// Get zeroed memory from the arena
+void* arenaCalloc(ARENA* arena, size_t count, size_t size) {
+  void *memory = arenaAlloc(arena, count * size);
+  memset(memory, 0, count * size);
+  return memory;
+}
+
+// Copy a string into the arena
+char* arenaCopy(ARENA* arena, char* text) {
+  size_t length = strlen(text) + 1;
+  return (char*) memcpy(arenaAlloc(arena, length), text, length);
+}
 
-//Array of transfer stations. Example: Fort Totten of green line is considered 1 transfer station and For Totten of red is considered as another.  
-TRANSFERSTATION** transferStations;
+// Give all the memory of the arena back
+void freeArena(ARENA* arena) {
+  ARENABLOCK *block = arena->blocks;
+  while(block != NULL) {
+    ARENABLOCK *next = block->next;
+    free(block);
+    block = next;
+  }
+  free(arena);
+}
 
 // Create a line (Root)
-LINE* makeLine() {
+LINE* makeLine(ARENA* arena) {
   LINE * temp;
-  temp = NEW(LINE);
+  temp = (LINE*) arenaAlloc(arena, sizeof(LINE));
   if (temp != NULL) {
     temp->numOfStations = 0;
     temp->start = NULL;
@@ -95,475 +922,5091 @@ LINE* makeLine() {
 }
 
 // Creat a new node with the data as passed
-STATION* makeStation(char* lineName, char* stationName, int stationNumber, int numOfTransferLines, int timeToReach, int stopTime, char* transferLines[], int transferTimes[]) {
+STATION* makeStation(ARENA* arena, char* lineName, char* stationName, int stationNumber, int numOfTransferLines, int timeToReach, int stopTime, char* transferLines[], int transferTimes[]) {
   STATION* temp;
-  temp = NEW(STATION);
+  temp = (STATION*) arenaAlloc(arena, sizeof(STATION));
   if (temp != NULL) {
     temp->lineName = lineName;
     temp->stationName = stationName;
+    temp->nameId = -1;
+    temp->lineId = -1;
+    temp->id = -1;
     temp->stationNumber = stationNumber;
     temp->numOfTransferLines = numOfTransferLines;
     temp->timeToReach = timeToReach;
     temp->stopTime = stopTime;
     temp->next = NULL;
     temp->prev = NULL;
-    if(numOfTransferLines!=0) {
-      for(int i=0; i<numOfTransferLines; i++) {
-        temp->transferLines[i] = transferLines[i];
-        temp->transferTimes[i] = transferTimes[i];
-      }
-    }
+    temp->transferLines = transferLines;
+    temp->transferTimes = transferTimes;
+  }
+  return temp;
+}
+
+// Create new node with the passed data and insert at the tail of the list
+STATION* insertStationInLine(ARENA* arena, LINE *line, char* lineName, char* stationName, int stationNumber, int numOfTransferLines, int timeToReach, int stopTime, char* transferLines[], int transferTimes[]) {
+
+  STATION *temp;
+  temp = makeStation(arena,lineName,stationName,stationNumber,numOfTransferLines,timeToReach,stopTime,transferLines,transferTimes);
+  
+  if (temp == NULL) return NULL; // fail, cannot create new NODE
+
+  if (line == NULL) {
+    line = makeLine(arena);
+    if (line == NULL) return NULL;   // fail, cannot create ROOT
+  }
+
+  (line->numOfStations)++;
+
+  if (line->numOfStations == 1)              // if previously the list is empty
+    line->start = line->end = temp;
+
+  else {
+    line->end->next = temp;
+    temp->prev = line->end;
+    line->end = temp;
+  }
+  return temp;
+}
+
+
+// FNV-1a hash of a name
+unsigned int hashName(char* name) {
+  unsigned int hash = 2166136261u;
+  while(*name != '\0') {
+    hash ^= (unsigned char) *name++;
+    hash *= 16777619u;
   }
+  return hash;
+}
+
+// Create an empty symbol table in an arena
+SYMBOLS* makeSymbols(ARENA* arena) {
+  SYMBOLS *temp;
+  temp = (SYMBOLS*) arenaAlloc(arena, sizeof(SYMBOLS));
+  if(temp != NULL) {
+    temp->arena = arena;
+    temp->numOfNames = 0;
+    temp->maxNames = 16;
+    temp->names = (char**) arenaAlloc(arena, sizeof(char*) * temp->maxNames);
+    temp->capacity = 32;
+    temp->slots = (int*) arenaAlloc(arena, sizeof(int) * temp->capacity);
+    for(int i=0; i<temp->capacity; i++) temp->slots[i] = -1;
+  }
+  return temp;
+}
+
+// Get the slot where a name is stored, or the empty slot where it would go
+int findSlot(SYMBOLS* symbols, char* name) {
+  int mask = symbols->capacity - 1;
+  int slot = hashName(name) & mask;
+  while(symbols->slots[slot] != -1 && strcmp(symbols->names[symbols->slots[slot]], name) != 0)
+    slot = (slot + 1) & mask;
+  return slot;
+}
+
+// Get the id of a name, -1 if it was never added
+int lookupName(SYMBOLS* symbols, char* name) {
+  return symbols->slots[findSlot(symbols, name)];
+}
+
+/*
+ *************************************************************
+ * Get the id of a name, adding a copy of it if it is new. The
+ * table doubles when it gets half full. The old arrays stay in
+ * the arena until it is freed.
+ *************************************************************
+ */
+int internName(SYMBOLS* symbols, char* name) {
+
+  int slot = findSlot(symbols, name);
+  if(symbols->slots[slot] != -1) return symbols->slots[slot];
+
+  if(symbols->numOfNames == symbols->maxNames) {
+    char **names = (char**) arenaAlloc(symbols->arena, sizeof(char*) * symbols->maxNames * 2);
+    memcpy(names, symbols->names, sizeof(char*) * symbols->maxNames);
+    symbols->names = names;
+    symbols->maxNames *= 2;
+  }
+  symbols->names[symbols->numOfNames] = arenaCopy(symbols->arena, name);
+  symbols->slots[slot] = symbols->numOfNames++;
+
+  if(2*symbols->numOfNames > symbols->capacity) {
+    symbols->capacity *= 2;
+    symbols->slots = (int*) arenaAlloc(symbols->arena, sizeof(int) * symbols->capacity);
+    for(int i=0; i<symbols->capacity; i++) symbols->slots[i] = -1;
+    for(int id=0; id<symbols->numOfNames; id++)
+      symbols->slots[findSlot(symbols, symbols->names[id])] = id;
+  }
+  return symbols->numOfNames - 1;
+}
+
+
+// Letter of a name as the name index stores it
+char foldLetter(char c) {
+  return c == '_' ? ' ' : (char) tolower((unsigned char) c);
+}
+
+// Fold a name into a buffer of size bytes, without the white space around it
+void foldName(char* name, char* folded, size_t size) {
+  size_t length = 0;
+  while(isspace((unsigned char) *name)) name++;
+  for(; *name != '\0' && length < size-1; name++) folded[length++] = foldLetter(*name);
+  while(length > 0 && isspace((unsigned char) folded[length-1])) length--;
+  folded[length] = '\0';
+}
+
+//Folded name being sorted by makeNameIndex. Its first 8 letters are packed in key, so most names sort without strcmp.
+typedef struct {
+  unsigned long long key;
+  char* name;
+  int id;
+} FOLDEDNAME;
+
+int compareFoldedNames(const void* a, const void* b) {
+  const FOLDEDNAME *x = (const FOLDEDNAME*) a, *y = (const FOLDEDNAME*) b;
+  if(x->key != y->key) return x->key < y->key ? -1 : 1;
+  int order = strlen(x->name) < 8 ? 0 : strcmp(x->name + 8, y->name + 8);
+  return order != 0 ? order : (x->id > y->id) - (x->id < y->id);
+}
+
+/*
+ *************************************************************
+ * Build the name index of a symbol table. The folded names are
+ * sorted and added in that order, so a name only adds the
+ * nodes past the start it shares with the one before it, and
+ * every node is closed once no later name can go below it.
+ *************************************************************
+ */
+NAMEINDEX* makeNameIndex(SYMBOLS* symbols) {
+
+  int numOfNames = symbols->numOfNames;
+  size_t length = 0, longest = 0;
+  for(int id=0; id<numOfNames; id++) {
+    size_t nameLength = strlen(symbols->names[id]);
+    length += nameLength + 1;
+    if(nameLength > longest) longest = nameLength;
+  }
+
+  char *text = (char*) malloc(length), *next = text;
+  FOLDEDNAME *folded = (FOLDEDNAME*) malloc(sizeof(FOLDEDNAME) * numOfNames);
+  int *path = (int*) malloc(sizeof(int) * (longest + 1));
+  for(int id=0; id<numOfNames; id++) {
+    size_t nameLength = strlen(symbols->names[id]);
+    folded[id].key = 0;
+    for(size_t i=0; i<nameLength; i++) {
+      next[i] = foldLetter(symbols->names[id][i]);
+      if(i < 8) folded[id].key |= (unsigned long long) (unsigned char) next[i] << (56 - 8*i);
+    }
+    next[nameLength] = '\0';
+    folded[id].name = next;
+    folded[id].id = id;
+    next += nameLength + 1;
+  }
+  qsort(folded, numOfNames, sizeof(FOLDEDNAME), compareFoldedNames);
+
+  //At most one node per letter and the root
+  size_t maxNodes = length - numOfNames + 1;
+  NAMEINDEX *index = NEW(NAMEINDEX);
+  index->symbols = symbols;
+  index->letters = (char*) malloc(maxNodes);
+  index->ends = (int*) malloc(sizeof(int) * maxNodes);
+  index->names = (int*) malloc(sizeof(int) * maxNodes);
+  index->sameName = (int*) malloc(sizeof(int) * numOfNames);
+  index->letters[0] = '\0';
+  index->names[0] = -1;
+  index->numOfNodes = 1;
+
+  char *previous = "";
+  int depth = 0; //path[d] is the node at depth d of the previous name
+  path[0] = 0;
+  for(int k=0; k<numOfNames; k++) {
+    int id = folded[k].id, common = 0;
+    char *name = folded[k].name;
+    while(name[common] != '\0' && name[common] == previous[common]) common++;
+    while(depth > common) index->ends[path[depth--]] = index->numOfNodes;
+    while(name[depth] != '\0') {
+      int node = index->numOfNodes++;
+      index->letters[node] = name[depth];
+      index->names[node] = -1;
+      path[++depth] = node;
+    }
+
+    //Sorted by id after the name, so a name that folds the same as the one before goes at the end of the chain
+    int *last = &index->names[path[depth]];
+    while(*last != -1) last = &index->sameName[*last];
+    *last = id;
+    index->sameName[id] = -1;
+    previous = name;
+  }
+  while(depth > 0) index->ends[path[depth--]] = index->numOfNodes;
+  index->ends[0] = index->numOfNodes;
+
+  free(text);
+  free(folded);
+  free(path);
+  return index;
+}
+
+void freeNameIndex(NAMEINDEX* index) {
+  free(index->letters);
+  free(index->ends);
+  free(index->names);
+  free(index->sameName);
+  free(index);
+}
+
+// Get the node where a folded text ends, -1 if no name starts with it
+int findNameNode(NAMEINDEX* index, char* text) {
+  int node = 0;
+  for(; *text != '\0'; text++) {
+    int child = node + 1, end = index->ends[node];
+    while(child < end && (unsigned char) index->letters[child] < (unsigned char) *text) child = index->ends[child];
+    if(child == end || index->letters[child] != *text) return -1;
+    node = child;
+  }
+  return node;
+}
+
+// Get the ids of up to maxIds names that start with a folded text, in the order of the folded names
+int completeName(NAMEINDEX* index, char* text, int ids[], int maxIds) {
+  int node = findNameNode(index, text), numOfIds = 0;
+  if(node == -1) return 0;
+  for(int end = index->ends[node]; node < end && numOfIds < maxIds; node++)
+    for(int id = index->names[node]; id != -1 && numOfIds < maxIds; id = index->sameName[id])
+      ids[numOfIds++] = id;
+  return numOfIds;
+}
+
+// Keep a match if there is room or it is nearer than the last one kept. It goes after the ones as near.
+// maxDistance is lowered once there is no room, so that the search only goes down to nearer names.
+void addMatch(NAMEMATCH* match, int id, int distance) {
+  int i = match->numOfMatches;
+  if(i == match->maxMatches) i--;
+  else match->numOfMatches++;
+  for(; i > 0 && match->distances[i-1] > distance; i--) {
+    match->ids[i] = match->ids[i-1];
+    match->distances[i] = match->distances[i-1];
+  }
+  match->ids[i] = id;
+  match->distances[i] = distance;
+  //Only a nearer name can be kept now
+  if(match->numOfMatches == match->maxMatches) match->maxDistance = match->distances[match->maxMatches-1] - 1;
+}
+
+/*
+ *************************************************************
+ * Fill the row of edit distances of every child of a node from
+ * the row of the node, keep the names that end there within
+ * maxDistance of the whole text and go down the children whose
+ * row still has a distance within it.
+ *************************************************************
+ */
+void matchChildren(NAMEMATCH* match, int node, int depth) {
+
+  NAMEINDEX *index = match->index;
+  char *text = match->text;
+  int width = match->length + 1;
+  if(depth == match->length + match->maxDistance) return; //Every longer name has too many extra letters
+
+  int *above = match->rows + depth*width, *row = above + width;
+  for(int child = node+1; child < index->ends[node]; child = index->ends[child]) {
+    char letter = index->letters[child];
+    int nearest = row[0] = depth + 1;
+    for(int j=1; j<width; j++) {
+      int distance = above[j-1] + (text[j-1] != letter);
+      if(above[j] + 1 < distance) distance = above[j] + 1;
+      if(row[j-1] + 1 < distance) distance = row[j-1] + 1;
+      //Two letters swapped
+      if(depth > 0 && j > 1 && text[j-1] == index->letters[node] && text[j-2] == letter && above[j-2-width] + 1 < distance)
+        distance = above[j-2-width] + 1;
+      row[j] = distance;
+      if(distance < nearest) nearest = distance;
+    }
+    for(int id = index->names[child]; id != -1 && row[width-1] <= match->maxDistance; id = index->sameName[id])
+      addMatch(match, id, row[width-1]);
+    if(nearest <= match->maxDistance) matchChildren(match, child, depth+1);
+  }
+}
+
+// Get the ids of up to maxIds names within the edit distance of a folded text, nearest first
+int matchName(NAMEINDEX* index, char* text, int ids[], int distances[], int maxIds) {
+  NAMEMATCH match;
+  match.index = index;
+  match.text = text;
+  match.length = (int) strlen(text);
+  match.maxDistance = match.length <= SHORT_NAME ? 1 : MAX_EDIT_DISTANCE;
+  match.rows = (int*) malloc(sizeof(int) * (match.length + match.maxDistance + 1) * (match.length + 1));
+  match.ids = ids;
+  match.distances = distances;
+  match.numOfMatches = 0;
+  match.maxMatches = maxIds;
+  for(int j=0; j<=match.length; j++) match.rows[j] = j;
+  matchChildren(&match, 0, 0);
+  free(match.rows);
+  return match.numOfMatches;
+}
+
+
+// Read a whole number that is not negative from a token of the metro file, false if the token is not one
+bool readNumber(char* token, int* value) {
+  char *end;
+  long number = strtol(token, &end, 10);
+  if(end == token || *end != '\0' || number < 0 || number > INT_MAX) return false;
+  *value = (int) number;
+  return true;
+}
+
+// Write what is wrong with a row of the metro file to message
+void reportMetroError(char* message, size_t size, char* fileName, int rowNumber, char* problem) {
+  snprintf(message, size, "Error on line %d of %s: %s", rowNumber, fileName, problem);
+}
+
+
+/*
+ *************************************************
+ * Read the stations from the file along with its 
+ * properties and store it in the data strcuture.
+ * The file has any number of lines, each one a
+ * "name (number of stations)" row followed by its
+ * stations, and is read in one pass. Rows, names
+ * and transfers can be of any length. Returns the
+ * lines, in the order of their ids in lineNames,
+ * or NULL with what is wrong written to message.
+ *************************************************
+ */
+LINE** readStationsFromFile(char* fileName, SYMBOLS* stationNames, SYMBOLS* lineNames, ARENA* arena, char* message, size_t size) {
+
+  FILE *metro = fopen(fileName, "r");
+  if(metro == NULL) {
+    snprintf(message, size, "%s file could not be opened", fileName);
+    return NULL;
+  }
+
+  char *row = NULL, problem[300];
+  size_t rowSize = 0;
+  int maxLines = 8, maxTokens = 16;
+  LINE **line = (LINE**) arenaAlloc(arena, sizeof(LINE*) * maxLines);
+  char **tokens = (char**) malloc(sizeof(char*) * maxTokens);
+  int rowNumber = 0, i = -1, numOfStations = 0, stationNumber = 0;
+  bool ok = true;
+
+  while(ok && getline(&row, &rowSize, metro) != -1) {
+    rowNumber++;
+    int n = 0;
+    for(char *token = strtok(row, " \t\r\n"); token != NULL; token = strtok(NULL, " \t\r\n")) {
+      if(n == maxTokens) {
+        maxTokens *= 2;
+        tokens = (char**) realloc(tokens, sizeof(char*) * maxTokens);
+      }
+      tokens[n++] = token;
+    }
+    if(n == 0) continue; //Blank line between two lines
+
+    //A line row, once the stations of the line before it are all read
+    if(stationNumber == numOfStations) {
+      if(n != 2 || sscanf(tokens[1], "(%d)", &numOfStations) != 1 || numOfStations < 1) {
+        reportMetroError(message, size, fileName, rowNumber, "expected a line and its number of stations, as \"green (21)\"");
+        ok = false;
+        break;
+      }
+      i = lineNames->numOfNames;
+      if(i == maxLines) {
+        LINE **lines = (LINE**) arenaAlloc(arena, sizeof(LINE*) * maxLines * 2);
+        memcpy(lines, line, sizeof(LINE*) * maxLines);
+        line = lines;
+        maxLines *= 2;
+      }
+      line[i] = makeLine(arena);
+      if(internName(lineNames, tokens[0]) != i) {
+        snprintf(problem, sizeof(problem), "%.100s line is listed twice", tokens[0]);
+        reportMetroError(message, size, fileName, rowNumber, problem);
+        ok = false;
+        break;
+      }
+      stationNumber = 0;
+      continue;
+    }
+
+    //A station is: name, transfers, time from first stop, stop time and then a line and a time for every transfer.
+    //The first and last stations of a line have no stop time, so the transfers are always taken from the end.
+    int numOfTransferLines = 0, timeToReach = 0, stopTime = 0;
+    if(n == 2 && tokens[1][0] == '(') {
+      snprintf(problem, sizeof(problem), "%.100s line has %d stations, not %d", lineNames->names[i], stationNumber, numOfStations);
+      reportMetroError(message, size, fileName, rowNumber, problem);
+      ok = false;
+      break;
+    }
+    if(n < 3 || !readNumber(tokens[1], &numOfTransferLines) || !readNumber(tokens[2], &timeToReach)) {
+      reportMetroError(message, size, fileName, rowNumber, "expected a station, its number of transfers and its time from the first station");
+      ok = false;
+      break;
+    }
+    if(numOfTransferLines > (n-3)/2 || (n != 3+(numOfTransferLines*2) && n != 4+(numOfTransferLines*2))) {
+      snprintf(problem, sizeof(problem), "%.100s station has %d transfers, so it needs %d or %d values after its name, not %d",
+        tokens[0], numOfTransferLines, 2+(numOfTransferLines*2), 3+(numOfTransferLines*2), n-1);
+      reportMetroError(message, size, fileName, rowNumber, problem);
+      ok = false;
+      break;
+    }
+    if(n == 4+(numOfTransferLines*2) && !readNumber(tokens[3], &stopTime)) {
+      reportMetroError(message, size, fileName, rowNumber, "bad stop time");
+      ok = false;
+      break;
+    }
+
+    // Store the transfer lines and the transfer times in their respective arrays.
+    char **transferLines = NULL;
+    int *transferTimes = NULL;
+    if(numOfTransferLines > 0) {
+      transferLines = (char**) arenaAlloc(arena, sizeof(char*) * numOfTransferLines);
+      transferTimes = (int*) arenaAlloc(arena, sizeof(int) * numOfTransferLines);
+    }
+    for(int t=0; ok && t<numOfTransferLines; t++) {
+      char **transfer = &tokens[n-(numOfTransferLines*2)+(t*2)];
+      transferLines[t] = arenaCopy(arena, transfer[0]);
+      if(!readNumber(transfer[1], &transferTimes[t])) {
+        snprintf(problem, sizeof(problem), "bad transfer time to %.100s line", transfer[0]);
+        reportMetroError(message, size, fileName, rowNumber, problem);
+        ok = false;
+      }
+    }
+    if(!ok) break;
+    //Create the structure object and insert it in the list. The names are the copies kept by the symbol tables.
+    int nameId = internName(stationNames, tokens[0]);
+    STATION *station = insertStationInLine(arena, line[i], lineNames->names[i], stationNames->names[nameId], ++stationNumber, numOfTransferLines, timeToReach, stopTime, transferLines, transferTimes);
+    station->nameId = nameId;
+    station->lineId = i;
+  }
+  if(ok && stationNumber < numOfStations) {
+    snprintf(problem, sizeof(problem), "%.100s line has %d stations, not %d", lineNames->names[i], stationNumber, numOfStations);
+    reportMetroError(message, size, fileName, rowNumber, problem);
+    ok = false;
+  }
+  free(row);
+  free(tokens);
+  fclose(metro);
+  return ok ? line : NULL;
+}
+
+
+/*
+ *****************************************************************
+ * Get the direction in which the line traversal has to be done.
+ *****************************************************************
+ */
+int getDirection(GRAPHSTATION *source, GRAPHSTATION *dest) {
+
+   int direction = 0; // 0 - towards end of line, 1 - towards start of line
+
+   if(source->stationNumber > dest->stationNumber) {
+     direction = 1;
+   }
+   else if (source->stationNumber < dest->stationNumber) {
+     direction = 0;
+   }
+   return direction;
+}
+
+
+/*
+ *****************************************************************
+ * Get the station id on the other line to which a transfer goes.
+ * Returns -1 if the transfer line is unknown or does not stop at
+ * this station.
+ *****************************************************************
+ */
+int getTransferTarget(GRAPH* g, STATION* station, int transfer) {
+  int lineId = lookupName(g->lineNames, station->transferLines[transfer]);
+  for(int i=g->nameStart[station->nameId]; i<g->nameStart[station->nameId+1]; i++) {
+    if(g->stations[g->nameStations[i]].line == lineId) return g->nameStations[i];
+  }
+  return -1;
+}
+
+
+/*
+ *****************************************************************
+ * Build the CSR edges from the lines, stations and transfers.
+ * First pass counts the edges going out of every node, second
+ * pass fills them in.
+ *****************************************************************
+ */
+void buildEdges(GRAPH* g) {
+
+  int edge = 0;
+  int *fill = NULL;
+
+  g->numOfNodes = 2*g->numOfStations;
+  g->edgeStart = (int*) arenaCalloc(g->arena, g->numOfNodes+1, sizeof(int));
+  for(int id=0; id<g->numOfStations; id++) {
+    GRAPHLINE *current = &g->lines[g->stations[id].line];
+    if(id > current->start) g->edgeStart[DEPARTURE(id)+1]++;
+    if(id < current->start + current->numOfStations - 1) g->edgeStart[DEPARTURE(id)+1]++;
+    g->edgeStart[ARRIVAL(id)+1] += 1 + g->stations[id].numOfTransfers;
+  }
+  for(int n=0; n<g->numOfNodes; n++)
+    g->edgeStart[n+1] += g->edgeStart[n];
+
+  g->numOfEdges = g->edgeStart[g->numOfNodes];
+  g->edgeTarget = (int*) arenaAlloc(g->arena, sizeof(int) * g->numOfEdges);
+  g->edgeWeight = (int*) arenaAlloc(g->arena, sizeof(int) * g->numOfEdges);
+  fill = (int*) malloc(sizeof(int) * g->numOfNodes);
+  memcpy(fill, g->edgeStart, sizeof(int) * g->numOfNodes);
+
+  //Ride, dwell and transfer edges
+  for(int id=0; id<g->numOfStations; id++) {
+    GRAPHSTATION *temp = &g->stations[id];
+    GRAPHLINE *current = &g->lines[temp->line];
+    if(id > current->start) {
+      edge = fill[DEPARTURE(id)]++;
+      g->edgeTarget[edge] = ARRIVAL(id-1);
+      g->edgeWeight[edge] = RIDE_TIME(temp, &g->stations[id-1]);
+    }
+    if(id < current->start + current->numOfStations - 1) {
+      edge = fill[DEPARTURE(id)]++;
+      g->edgeTarget[edge] = ARRIVAL(id+1);
+      g->edgeWeight[edge] = RIDE_TIME(temp, &g->stations[id+1]);
+    }
+    edge = fill[ARRIVAL(id)]++;
+    g->edgeTarget[edge] = DEPARTURE(id);
+    g->edgeWeight[edge] = temp->stopTime;
+    for(int t=temp->firstTransfer; t<temp->firstTransfer+temp->numOfTransfers; t++) {
+      edge = fill[ARRIVAL(id)]++;
+      g->edgeTarget[edge] = DEPARTURE(g->transfers[t].station);
+      g->edgeWeight[edge] = g->transfers[t].transferTime;
+    }
+  }
+  free(fill);
+}
+
+
+/*
+ *****************************************************************
+ * Build the routing graph from the lines read from metro.txt.
+ * The graph is allocated in the arena and takes it over.
+ *****************************************************************
+ */
+GRAPH* buildGraph(LINE* line[], SYMBOLS* stationNames, SYMBOLS* lineNames, ARENA* arena) {
+
+  GRAPH *g = (GRAPH*) arenaAlloc(arena, sizeof(GRAPH));
+  STATION *temp = NULL;
+  int id = 0, t = 0;
+  int *fill = NULL;
+
+  if(g == NULL) return NULL;
+
+  g->numOfLines = lineNames->numOfNames;
+  g->numOfStations = 0;
+  for(int i=0; i<g->numOfLines; i++)
+    g->numOfStations += line[i]->numOfStations;
+  g->numOfNames = stationNames->numOfNames;
+  g->stationNames = stationNames;
+  g->lineNames = lineNames;
+  g->arena = arena;
+  g->map = NULL;
+  g->mapSize = 0;
+  g->readOnly = false;
+  g->closed = NULL;
+  g->lines = (GRAPHLINE*) arenaAlloc(arena, sizeof(GRAPHLINE) * g->numOfLines);
+  g->stations = (GRAPHSTATION*) arenaAlloc(arena, sizeof(GRAPHSTATION) * g->numOfStations);
+  g->nameStart = (int*) arenaCalloc(arena, g->numOfNames+1, sizeof(int));
+  g->nameStations = (int*) arenaAlloc(arena, sizeof(int) * g->numOfStations);
+
+  //Assign the ids and group the station ids by name
+  for(int i=0; i<g->numOfLines; i++) {
+    g->lines[i].start = id;
+    g->lines[i].numOfStations = line[i]->numOfStations;
+    for(temp = line[i]->start; temp != NULL; temp = temp->next) {
+      GRAPHSTATION *station = &g->stations[id];
+      temp->id = id;
+      station->name = temp->nameId;
+      station->line = temp->lineId;
+      station->stationNumber = temp->stationNumber;
+      station->timeToReach = temp->timeToReach;
+      station->stopTime = temp->stopTime;
+      station->rideClock = temp->timeToReach;
+      if(id > g->lines[i].start) station->rideClock += g->stations[id-1].rideClock - g->stations[id-1].timeToReach + g->stations[id-1].stopTime;
+      g->nameStart[temp->nameId+1]++;
+      id++;
+    }
+  }
+  for(int n=0; n<g->numOfNames; n++)
+    g->nameStart[n+1] += g->nameStart[n];
+  fill = (int*) malloc(sizeof(int) * g->numOfNames);
+  memcpy(fill, g->nameStart, sizeof(int) * g->numOfNames);
+  for(id=0; id<g->numOfStations; id++)
+    g->nameStations[fill[g->stations[id].name]++] = id;
+  free(fill);
+
+  //Keep the transfers whose line stops at the station
+  g->numOfTransfers = 0;
+  for(int i=0; i<g->numOfLines; i++) {
+    for(temp = line[i]->start; temp != NULL; temp = temp->next) {
+      for(int k=0; k<temp->numOfTransferLines; k++)
+        if(getTransferTarget(g, temp, k) != -1) g->numOfTransfers++;
+    }
+  }
+  g->transfers = (GRAPHTRANSFER*) arenaAlloc(arena, sizeof(GRAPHTRANSFER) * g->numOfTransfers);
+  for(int i=0; i<g->numOfLines; i++) {
+    for(temp = line[i]->start; temp != NULL; temp = temp->next) {
+      g->stations[temp->id].firstTransfer = t;
+      for(int k=0; k<temp->numOfTransferLines; k++) {
+        int target = getTransferTarget(g, temp, k);
+        if(target == -1) continue;
+        g->transfers[t].station = target;
+        g->transfers[t].transferTime = temp->transferTimes[k];
+        t++;
+      }
+      g->stations[temp->id].numOfTransfers = t - g->stations[temp->id].firstTransfer;
+    }
+  }
+
+  buildEdges(g);
+  return g;
+}
+
+
+/*
+ *****************************************************************
+ * Free a graph and everything it owns with one call.
+ *****************************************************************
+ */
+void freeGraph(GRAPH* g) {
+  if(g->map != NULL) munmap(g->map, g->mapSize);
+  freeArena(g->arena);
+}
+
+
+/*
+ *****************************************************************
+ * Write the graph as a network image (see NETWORKHEADER).
+ *****************************************************************
+ */
+void writeNetworkImage(GRAPH* g, char* fileName) {
+
+  NETWORKHEADER header;
+  int stringPoolSize = 0;
+  int *stationNameOffsets = (int*) malloc(sizeof(int) * g->numOfNames);
+  int *lineNameOffsets = (int*) malloc(sizeof(int) * g->numOfLines);
+  FILE *file = fopen(fileName, "wb");
+
+  if(file == NULL) {
+    printf("\n%s file could not be opened\n", fileName);
+    exit(0);
+  }
+  for(int n=0; n<g->numOfNames; n++) {
+    stationNameOffsets[n] = stringPoolSize;
+    stringPoolSize += strlen(g->stationNames->names[n]) + 1;
+  }
+  for(int i=0; i<g->numOfLines; i++) {
+    lineNameOffsets[i] = stringPoolSize;
+    stringPoolSize += strlen(g->lineNames->names[i]) + 1;
+  }
+
+  memcpy(header.magic, NETWORK_MAGIC, 4);
+  header.version = NETWORK_VERSION;
+  header.numOfLines = g->numOfLines;
+  header.numOfStations = g->numOfStations;
+  header.numOfNames = g->numOfNames;
+  header.numOfTransfers = g->numOfTransfers;
+  header.numOfNodes = g->numOfNodes;
+  header.numOfEdges = g->numOfEdges;
+  header.hashCapacity = g->stationNames->capacity;
+  header.stringPoolSize = stringPoolSize;
+
+  fwrite(&header, sizeof(header), 1, file);
+  fwrite(g->lines, sizeof(GRAPHLINE), g->numOfLines, file);
+  fwrite(g->stations, sizeof(GRAPHSTATION), g->numOfStations, file);
+  fwrite(g->transfers, sizeof(GRAPHTRANSFER), g->numOfTransfers, file);
+  fwrite(g->nameStart, sizeof(int), g->numOfNames+1, file);
+  fwrite(g->nameStations, sizeof(int), g->numOfStations, file);
+  fwrite(g->edgeStart, sizeof(int), g->numOfNodes+1, file);
+  fwrite(g->edgeTarget, sizeof(int), g->numOfEdges, file);
+  fwrite(g->edgeWeight, sizeof(int), g->numOfEdges, file);
+  fwrite(stationNameOffsets, sizeof(int), g->numOfNames, file);
+  fwrite(lineNameOffsets, sizeof(int), g->numOfLines, file);
+  fwrite(g->stationNames->slots, sizeof(int), g->stationNames->capacity, file);
+  for(int n=0; n<g->numOfNames; n++)
+    fwrite(g->stationNames->names[n], 1, strlen(g->stationNames->names[n]) + 1, file);
+  for(int i=0; i<g->numOfLines; i++)
+    fwrite(g->lineNames->names[i], 1, strlen(g->lineNames->names[i]) + 1, file);
+
+  if(fclose(file) != 0) {
+    printf("\n%s file could not be written\n", fileName);
+    exit(0);
+  }
+  free(stationNameOffsets);
+  free(lineNameOffsets);
+}
+
+
+// Write the ints of a table of the network source, 16 to a row. An empty table gets one 0, C has no empty arrays.
+void writeIntTable(FILE* file, char* name, int values[], int numOfValues) {
+  fprintf(file, "static const int %s[] = {", name);
+  for(int i=0; i<numOfValues; i++) fprintf(file, "%s%d,", i % 16 == 0 ? "\n  " : " ", values[i]);
+  fprintf(file, numOfValues == 0 ? "\n  0\n};\n\n" : "\n};\n\n");
+}
+
+// Write the names of a symbol table of the network source as C strings
+void writeNameTable(FILE* file, char* name, SYMBOLS* symbols) {
+  fprintf(file, "static char* const %s[] = {\n", name);
+  for(int n=0; n<symbols->numOfNames; n++) {
+    fprintf(file, "  \"");
+    for(unsigned char *c = (unsigned char*) symbols->names[n]; *c != '\0'; c++) {
+      if(*c == '"' || *c == '\\' || *c == '?') fprintf(file, "\\%c", *c); //\? so that no trigraph is read
+      else if(*c < ' ' || *c > '~') fprintf(file, "\\%03o", *c);
+      else fputc(*c, file);
+    }
+    fprintf(file, "\",\n");
+  }
+  fprintf(file, "};\n\n");
+}
+
+/*
+ *****************************************************************
+ * Write the graph as a C source of static const tables (--embed),
+ * the same arrays as a network image with the hash slots of both
+ * symbol tables. A build with -DEMBEDDED_NETWORK includes it as
+ * metroNetwork.h and routes from the tables without reading,
+ * parsing or allocating anything per station.
+ *****************************************************************
+ */
+void writeEmbeddedNetwork(GRAPH* g, char* metroFile, char* fileName) {
+
+  FILE *file = fopen(fileName, "w");
+  if(file == NULL) {
+    printf("\n%s file could not be opened\n", fileName);
+    exit(0);
+  }
+
+  fprintf(file, "/*\n * Network compiled into metroTripPlanner by \"make metroKiosk\".\n");
+  fprintf(file, " * Generated from %s by metroTripPlanner --embed, do not edit.\n */\n\n", metroFile);
+  fprintf(file, "#if NETWORK_VERSION != %d\n#error \"%s is out of date, run metroTripPlanner --embed again\"\n#endif\n\n",
+          NETWORK_VERSION, fileName);
+  fprintf(file, "#define EMBEDDED_LINES %d\n#define EMBEDDED_STATIONS %d\n#define EMBEDDED_NAMES %d\n", g->numOfLines, g->numOfStations, g->numOfNames);
+  fprintf(file, "#define EMBEDDED_TRANSFERS %d\n#define EMBEDDED_NODES %d\n#define EMBEDDED_EDGES %d\n", g->numOfTransfers, g->numOfNodes, g->numOfEdges);
+  fprintf(file, "#define EMBEDDED_STATION_SLOTS %d\n#define EMBEDDED_LINE_SLOTS %d\n\n", g->stationNames->capacity, g->lineNames->capacity);
+
+  //Start and number of stations of every line
+  fprintf(file, "static const GRAPHLINE embeddedLines[] = {\n");
+  for(int i=0; i<g->numOfLines; i++) fprintf(file, "  {%d, %d},\n", g->lines[i].start, g->lines[i].numOfStations);
+  fprintf(file, "};\n\n");
+
+  //name, line, stationNumber, timeToReach, stopTime, rideClock, firstTransfer, numOfTransfers
+  fprintf(file, "static const GRAPHSTATION embeddedStations[] = {\n");
+  for(int s=0; s<g->numOfStations; s++) {
+    GRAPHSTATION *station = &g->stations[s];
+    fprintf(file, "  {%d, %d, %d, %d, %d, %d, %d, %d},\n", station->name, station->line, station->stationNumber, station->timeToReach,
+            station->stopTime, station->rideClock, station->firstTransfer, station->numOfTransfers);
+  }
+  fprintf(file, "};\n\n");
+
+  fprintf(file, "static const GRAPHTRANSFER embeddedTransfers[] = {\n");
+  for(int t=0; t<g->numOfTransfers; t++) fprintf(file, "  {%d, %d},\n", g->transfers[t].station, g->transfers[t].transferTime);
+  fprintf(file, g->numOfTransfers == 0 ? "  {0, 0}\n};\n\n" : "};\n\n");
+
+  writeIntTable(file, "embeddedNameStart", g->nameStart, g->numOfNames+1);
+  writeIntTable(file, "embeddedNameStations", g->nameStations, g->numOfStations);
+  writeIntTable(file, "embeddedEdgeStart", g->edgeStart, g->numOfNodes+1);
+  writeIntTable(file, "embeddedEdgeTarget", g->edgeTarget, g->numOfEdges);
+  writeIntTable(file, "embeddedEdgeWeight", g->edgeWeight, g->numOfEdges);
+  writeIntTable(file, "embeddedStationSlots", g->stationNames->slots, g->stationNames->capacity);
+  writeIntTable(file, "embeddedLineSlots", g->lineNames->slots, g->lineNames->capacity);
+  writeNameTable(file, "embeddedStationNames", g->stationNames);
+  writeNameTable(file, "embeddedLineNames", g->lineNames);
+
+  if(fclose(file) != 0) {
+    printf("\n%s file could not be written\n", fileName);
+    exit(0);
+  }
+}
+
+
+/*
+ ******************************************************************
+ * Check the arrays of a network image before a search indexes
+ * with them. Every line is a run of stations of that line, every
+ * station, transfer, name and edge points inside its array, the
+ * CSR offsets go up from 0 to the end, no edge, stop or transfer
+ * is longer than MAX_WEIGHT, the hash slots hold names and leave
+ * a slot empty, and every name is a string of the pool.
+ ******************************************************************
+ */
+bool checkNetworkImage(GRAPH* g, int stationNameOffsets[], int lineNameOffsets[], int hashSlots[], int hashCapacity,
+                       char* strings, int stringPoolSize) {
+
+  if(g->numOfNodes != 2 * g->numOfStations) return false;
+  for(int i=0; i<g->numOfLines; i++) {
+    GRAPHLINE *line = &g->lines[i];
+    if(line->start < 0 || line->numOfStations < 0 || line->start > g->numOfStations - line->numOfStations) return false;
+    for(int id=line->start; id<line->start+line->numOfStations; id++)
+      if(g->stations[id].line != i) return false;
+  }
+  for(int id=0; id<g->numOfStations; id++) {
+    GRAPHSTATION *station = &g->stations[id];
+    if(station->line < 0 || station->line >= g->numOfLines || station->name < 0 || station->name >= g->numOfNames) return false;
+    if(station->firstTransfer < 0 || station->numOfTransfers < 0 ||
+       station->firstTransfer > g->numOfTransfers - station->numOfTransfers) return false;
+    if(station->stationNumber < 0 || station->timeToReach < 0 || station->stopTime < 0 || station->stopTime > MAX_WEIGHT ||
+       station->rideClock < 0 || station->rideClock > INT_MAX/2) return false; //RIDE_TIME cannot overflow
+  }
+  for(int t=0; t<g->numOfTransfers; t++) {
+    if(g->transfers[t].station < 0 || g->transfers[t].station >= g->numOfStations) return false;
+    if(g->transfers[t].transferTime < 0 || g->transfers[t].transferTime > MAX_WEIGHT) return false;
+  }
+
+  if(g->nameStart[0] != 0 || g->nameStart[g->numOfNames] != g->numOfStations) return false;
+  for(int n=0; n<g->numOfNames; n++) {
+    if(g->nameStart[n+1] < g->nameStart[n]) return false;
+    for(int i=g->nameStart[n]; i<g->nameStart[n+1]; i++)
+      if(g->nameStations[i] < 0 || g->nameStations[i] >= g->numOfStations || g->stations[g->nameStations[i]].name != n) return false;
+  }
+  if(g->edgeStart[0] != 0 || g->edgeStart[g->numOfNodes] != g->numOfEdges) return false;
+  for(int n=0; n<g->numOfNodes; n++)
+    if(g->edgeStart[n+1] < g->edgeStart[n]) return false;
+  for(int e=0; e<g->numOfEdges; e++)
+    if(g->edgeTarget[e] < 0 || g->edgeTarget[e] >= g->numOfNodes || g->edgeWeight[e] > MAX_WEIGHT ||
+       (g->edgeWeight[e] < 0 && g->edgeWeight[e] != CLOSED)) return false;
+
+  //findSlot goes round the slots until it meets the name or an empty one
+  int used = 0;
+  if(hashCapacity <= g->numOfNames || (hashCapacity & (hashCapacity - 1)) != 0) return false;
+  for(int i=0; i<hashCapacity; i++) {
+    if(hashSlots[i] < -1 || hashSlots[i] >= g->numOfNames) return false;
+    if(hashSlots[i] != -1) used++;
+  }
+  if(used > g->numOfNames) return false;
+  if(stringPoolSize > 0 && strings[stringPoolSize-1] != '\0') return false;
+  for(int n=0; n<g->numOfNames; n++)
+    if(stationNameOffsets[n] < 0 || stationNameOffsets[n] >= stringPoolSize) return false;
+  for(int i=0; i<g->numOfLines; i++)
+    if(lineNameOffsets[i] < 0 || lineNameOffsets[i] >= stringPoolSize) return false;
+  return true;
+}
+
+
+/*
+ *****************************************************************
+ * Map a network image and point the graph arrays into it. Only
+ * the name pointer arrays are allocated, nothing per station.
+ * Returns NULL with what is wrong written to message.
+ *****************************************************************
+ */
+GRAPH* loadNetworkImage(char* fileName, STATS* s, char* message, size_t size) {
+
+  STAT_START(loadStart);
+  struct stat info;
+  ARENA *arena = makeArena(s);
+  GRAPH *g = (GRAPH*) arenaAlloc(arena, sizeof(GRAPH));
+  int fd = open(fileName, O_RDONLY);
+
+  g->arena = arena;
+  g->map = NULL;
+  if(fd == -1 || fstat(fd, &info) == -1) {
+    snprintf(message, size, "%s file could not be opened", fileName);
+    if(fd != -1) close(fd);
+    freeGraph(g);
+    return NULL;
+  }
+  g->mapSize = info.st_size;
+  g->map = mmap(NULL, g->mapSize, PROT_READ, MAP_SHARED, fd, 0);
+  g->readOnly = true;
+  g->closed = NULL;
+  close(fd);
+  if(g->map == MAP_FAILED) g->map = NULL;
+  if(g->mapSize < sizeof(NETWORKHEADER) || g->map == NULL) {
+    snprintf(message, size, "%s is not a network image", fileName);
+    freeGraph(g);
+    return NULL;
+  }
+
+  NETWORKHEADER *h = (NETWORKHEADER*) g->map;
+  if(memcmp(h->magic, NETWORK_MAGIC, 4) != 0 || h->version != NETWORK_VERSION) {
+    snprintf(message, size, "%s is not a version %d network image. Please run --compile again.", fileName, NETWORK_VERSION);
+    freeGraph(g);
+    return NULL;
+  }
+  if(h->numOfLines < 0 || h->numOfStations < 0 || h->numOfNames < 0 || h->numOfTransfers < 0 || h->numOfNodes < 0 ||
+     h->numOfEdges < 0 || h->hashCapacity < 0 || h->stringPoolSize < 0) {
+    snprintf(message, size, "%s is truncated or corrupt", fileName);
+    freeGraph(g);
+    return NULL;
+  }
+  size_t imageSize = sizeof(NETWORKHEADER) + sizeof(GRAPHLINE) * h->numOfLines + sizeof(GRAPHSTATION) * h->numOfStations
+    + sizeof(GRAPHTRANSFER) * h->numOfTransfers + sizeof(int) * (h->numOfNames + 1 + h->numOfStations)
+    + sizeof(int) * (h->numOfNodes + 1 + 2 * (size_t) h->numOfEdges) + sizeof(int) * (h->numOfNames + h->numOfLines)
+    + sizeof(int) * h->hashCapacity + h->stringPoolSize;
+  if(g->mapSize != imageSize) {
+    snprintf(message, size, "%s is truncated or corrupt", fileName);
+    freeGraph(g);
+    return NULL;
+  }
+
+  g->numOfLines = h->numOfLines;
+  g->numOfStations = h->numOfStations;
+  g->numOfNames = h->numOfNames;
+  g->numOfTransfers = h->numOfTransfers;
+  g->numOfNodes = h->numOfNodes;
+  g->numOfEdges = h->numOfEdges;
+  g->lines = (GRAPHLINE*) (h + 1);
+  g->stations = (GRAPHSTATION*) (g->lines + h->numOfLines);
+  g->transfers = (GRAPHTRANSFER*) (g->stations + h->numOfStations);
+  g->nameStart = (int*) (g->transfers + h->numOfTransfers);
+  g->nameStations = g->nameStart + h->numOfNames + 1;
+  g->edgeStart = g->nameStations + h->numOfStations;
+  g->edgeTarget = g->edgeStart + h->numOfNodes + 1;
+  g->edgeWeight = g->edgeTarget + h->numOfEdges;
+  int *stationNameOffsets = g->edgeWeight + h->numOfEdges;
+  int *lineNameOffsets = stationNameOffsets + h->numOfNames;
+  int *hashSlots = lineNameOffsets + h->numOfLines;
+  char *strings = (char*) (hashSlots + h->hashCapacity);
+  if(!checkNetworkImage(g, stationNameOffsets, lineNameOffsets, hashSlots, h->hashCapacity, strings, h->stringPoolSize)) {
+    snprintf(message, size, "%s is truncated or corrupt", fileName);
+    freeGraph(g);
+    return NULL;
+  }
+
+  //The station name index is used as it is in the image. It must not be added to.
+  g->stationNames = (SYMBOLS*) arenaAlloc(arena, sizeof(SYMBOLS));
+  g->stationNames->arena = arena;
+  g->stationNames->numOfNames = g->stationNames->maxNames = h->numOfNames;
+  g->stationNames->names = (char**) arenaAlloc(arena, sizeof(char*) * h->numOfNames);
+  for(int n=0; n<h->numOfNames; n++)
+    g->stationNames->names[n] = strings + stationNameOffsets[n];
+  g->stationNames->capacity = h->hashCapacity;
+  g->stationNames->slots = hashSlots;
+
+  g->lineNames = makeSymbols(arena);
+  for(int i=0; i<h->numOfLines; i++)
+    internName(g->lineNames, strings + lineNameOffsets[i]);
+  STAT_STOP(s, PHASE_LOAD, loadStart);
+  return g;
+}
+
+
+#ifdef EMBEDDED_NETWORK
+#include "metroNetwork.h"
+
+/*
+ *****************************************************************
+ * Point a graph at the tables compiled in from metroNetwork.h.
+ * The graph and its symbol tables are static, so the only thing
+ * allocated is the empty arena an update copies the tables to.
+ *****************************************************************
+ */
+GRAPH* loadEmbeddedNetwork(STATS* s) {
+
+  static GRAPH g;
+  static SYMBOLS stationNames, lineNames;
+
+  STAT_START(loadStart);
+  g.arena = makeArena(s);
+  g.map = NULL;
+  g.mapSize = 0;
+  g.readOnly = true;
+  g.closed = NULL;
+  g.numOfLines = EMBEDDED_LINES;
+  g.numOfStations = EMBEDDED_STATIONS;
+  g.numOfNames = EMBEDDED_NAMES;
+  g.numOfTransfers = EMBEDDED_TRANSFERS;
+  g.numOfNodes = EMBEDDED_NODES;
+  g.numOfEdges = EMBEDDED_EDGES;
+  g.lines = (GRAPHLINE*) embeddedLines;
+  g.stations = (GRAPHSTATION*) embeddedStations;
+  g.transfers = (GRAPHTRANSFER*) embeddedTransfers;
+  g.nameStart = (int*) embeddedNameStart;
+  g.nameStations = (int*) embeddedNameStations;
+  g.edgeStart = (int*) embeddedEdgeStart;
+  g.edgeTarget = (int*) embeddedEdgeTarget;
+  g.edgeWeight = (int*) embeddedEdgeWeight;
+
+  //Like the names of a network image, they must not be added to
+  stationNames.arena = lineNames.arena = g.arena;
+  stationNames.numOfNames = stationNames.maxNames = EMBEDDED_NAMES;
+  stationNames.names = (char**) embeddedStationNames;
+  stationNames.capacity = EMBEDDED_STATION_SLOTS;
+  stationNames.slots = (int*) embeddedStationSlots;
+  lineNames.numOfNames = lineNames.maxNames = EMBEDDED_LINES;
+  lineNames.names = (char**) embeddedLineNames;
+  lineNames.capacity = EMBEDDED_LINE_SLOTS;
+  lineNames.slots = (int*) embeddedLineSlots;
+  g.stationNames = &stationNames;
+  g.lineNames = &lineNames;
+  STAT_STOP(s, PHASE_LOAD, loadStart);
+  return &g;
+}
+#endif
+
+
+// Create the scratch space for timetable queries on a graph
+RAPTORSEARCH* makeRaptorSearch(int numOfStations) {
+  RAPTORSEARCH *temp;
+  temp = NEW(RAPTORSEARCH);
+  if(temp != NULL) {
+    size_t size = (size_t) (MAX_RIDES+1) * numOfStations;
+    temp->numOfStations = numOfStations;
+    temp->arrival = (int*) malloc(sizeof(int) * size);
+    temp->boardStop = (int*) malloc(sizeof(int) * size);
+    temp->boardTrip = (int*) malloc(sizeof(int) * size);
+    temp->best = (int*) malloc(sizeof(int) * numOfStations);
+    temp->marked = (int*) malloc(sizeof(int) * numOfStations);
+    temp->isMarked = (bool*) calloc(numOfStations, sizeof(bool));
+    temp->routeStart = (int*) malloc(sizeof(int) * 2 * numOfStations);
+    temp->queuedRoutes = (int*) malloc(sizeof(int) * 2 * numOfStations);
+    temp->touched = (int*) malloc(sizeof(int) * numOfStations);
+    temp->numMarked = temp->numQueued = temp->numTouched = 0;
+    for(size_t i=0; i<size; i++) temp->arrival[i] = NO_TIME;
+    for(int s=0; s<numOfStations; s++) temp->best[s] = NO_TIME;
+    for(int r=0; r<2*numOfStations; r++) temp->routeStart[r] = -1;
+  }
+  return temp;
+}
+
+void freeRaptorSearch(RAPTORSEARCH* r) {
+  free(r->arrival);
+  free(r->boardStop);
+  free(r->boardTrip);
+  free(r->best);
+  free(r->marked);
+  free(r->isMarked);
+  free(r->routeStart);
+  free(r->queuedRoutes);
+  free(r->touched);
+  free(r);
+}
+
+// Create the scratch space for alternative routes between the stations of a graph
+ALTERNATIVES* makeAlternatives(int numOfNames, int numOfStations) {
+  ALTERNATIVES *temp;
+  temp = NEW(ALTERNATIVES);
+  if(temp != NULL) {
+    temp->maxNodes = 1024;
+    temp->maxPaths = 64;
+    temp->nodes = (int*) malloc(sizeof(int) * temp->maxNodes);
+    temp->times = (int*) malloc(sizeof(int) * temp->maxNodes);
+    temp->paths = (ALTPATH*) malloc(sizeof(ALTPATH) * temp->maxPaths);
+    temp->nameStamp = (int*) calloc(numOfNames, sizeof(int));
+    temp->stationStamp = (int*) calloc(numOfStations, sizeof(int));
+    temp->stamp = 0;
+  }
+  return temp;
+}
+
+void freeAlternatives(ALTERNATIVES* a) {
+  free(a->nodes);
+  free(a->times);
+  free(a->paths);
+  free(a->nameStamp);
+  free(a->stationStamp);
+  free(a);
+}
+
+// Create the scratch space for searching a graph
+SEARCH* makeSearch(int numOfNodes) {
+  SEARCH *temp;
+  temp = NEW(SEARCH);
+  if(temp != NULL) {
+    temp->dist = (int*) malloc(sizeof(int) * numOfNodes);
+    temp->pred = (int*) malloc(sizeof(int) * numOfNodes);
+    temp->heap = (int*) malloc(sizeof(int) * numOfNodes);
+    temp->heapPos = (int*) malloc(sizeof(int) * numOfNodes);
+    temp->touched = (int*) malloc(sizeof(int) * numOfNodes);
+    temp->settled = (int*) malloc(sizeof(int) * numOfNodes);
+    temp->path = (int*) malloc(sizeof(int) * numOfNodes);
+    temp->legs = (LEG*) malloc(sizeof(LEG) * (numOfNodes/2));
+    temp->heapSize = 0;
+    temp->numTouched = 0;
+    temp->numSettled = 0;
+    temp->pathLength = 0;
+    temp->output = out;
+    temp->record = NULL;
+    temp->recordLength = temp->recordCapacity = 0;
+    temp->raptor = NULL;
+    temp->backward = NULL;
+    temp->alternatives = NULL;
+    temp->labels = NULL;
+    temp->capture = NULL;
+    memset(&temp->stats, 0, sizeof(STATS));
+    temp->network = NULL;
+    for(int n=0; n<numOfNodes; n++) {
+      temp->dist[n] = INT_MAX;
+      temp->pred[n] = -1;
+      temp->heapPos[n] = -1;
+    }
+  }
+  return temp;
+}
+
+// Free the scratch space of a search
+void freeSearch(SEARCH* s) {
+  free(s->dist);
+  free(s->pred);
+  free(s->heap);
+  free(s->heapPos);
+  free(s->touched);
+  free(s->settled);
+  free(s->path);
+  free(s->legs);
+  free(s->record);
+  if(s->raptor != NULL) freeRaptorSearch(s->raptor);
+  if(s->backward != NULL) freeSearch(s->backward);
+  if(s->alternatives != NULL) freeAlternatives(s->alternatives);
+  if(s->labels != NULL) freeSearch(s->labels);
+  if(s->capture != NULL) {
+    fclose(s->capture);
+    free(s->captured);
+  }
+#ifndef NO_STATS
+  mergeStats(&stats, &s->stats);
+#endif
+  free(s);
+}
+
+// Clear the nodes touched by the previous search
+void resetSearch(SEARCH* s) {
+  for(int i=0; i<s->numTouched; i++) {
+    int node = s->touched[i];
+    s->dist[node] = INT_MAX;
+    s->pred[node] = -1;
+    s->heapPos[node] = -1;
+  }
+  s->numTouched = 0;
+  s->numSettled = 0;
+  s->heapSize = 0;
+}
+
+// Move a node up the heap until its parent is not farther than it
+void heapSiftUp(SEARCH* s, int pos) {
+  int node = s->heap[pos];
+  while(pos > 0) {
+    int parent = (pos-1)/2;
+    if(s->dist[s->heap[parent]] <= s->dist[node]) break;
+    s->heap[pos] = s->heap[parent];
+    s->heapPos[s->heap[pos]] = pos;
+    pos = parent;
+  }
+  s->heap[pos] = node;
+  s->heapPos[node] = pos;
+}
+
+// Move a node down the heap until no child is nearer than it
+void heapSiftDown(SEARCH* s, int pos) {
+  int node = s->heap[pos];
+  while(2*pos+1 < s->heapSize) {
+    int child = 2*pos+1;
+    if(child+1 < s->heapSize && s->dist[s->heap[child+1]] < s->dist[s->heap[child]]) child++;
+    if(s->dist[node] <= s->dist[s->heap[child]]) break;
+    s->heap[pos] = s->heap[child];
+    s->heapPos[s->heap[pos]] = pos;
+    pos = child;
+  }
+  s->heap[pos] = node;
+  s->heapPos[node] = pos;
+}
+
+// Set a new (smaller) distance for a node, queueing it if needed
+void heapDecrease(SEARCH* s, int node, int dist, int pred) {
+  if(s->dist[node] == INT_MAX) s->touched[s->numTouched++] = node;
+  s->dist[node] = dist;
+  s->pred[node] = pred;
+  if(s->heapPos[node] == -1) {
+    s->heap[s->heapSize] = node;
+    s->heapPos[node] = s->heapSize;
+    s->heapSize++;
+    STAT_ADD(&s->stats, COUNT_HEAP_PUSHES, 1);
+  }
+  heapSiftUp(s, s->heapPos[node]);
+}
+
+// Remove and return the nearest node in the heap
+int heapPop(SEARCH* s) {
+  int node = s->heap[0];
+  s->heapSize--;
+  STAT_ADD(&s->stats, COUNT_HEAP_POPS, 1);
+  s->heapPos[node] = -1;
+  if(s->heapSize > 0) {
+    s->heap[0] = s->heap[s->heapSize];
+    heapSiftDown(s, 0);
+  }
+  return node;
+}
+
+
+/*
+ *****************************************************************
+ * Dijkstra from the departure nodes of every station with the
+ * source name id to the first settled arrival node of a station
+ * with the destination name id. Returns that arrival node, -1 if
+ * there is no path. With dest -1 the whole graph is searched.
+ *****************************************************************
+ */
+int findShortestPath(GRAPH* g, SEARCH* s, int source, int dest) {
+
+  int target = -1;
+
+  resetSearch(s);
+  for(int i=g->nameStart[source]; i<g->nameStart[source+1]; i++)
+    if(!IS_CLOSED(g, g->nameStations[i])) heapDecrease(s, DEPARTURE(g->nameStations[i]), 0, -1);
+
+  while(s->heapSize > 0) {
+    int node = heapPop(s);
+    s->settled[s->numSettled++] = node;
+    if(IS_ARRIVAL(node) && g->stations[STATION_OF_NODE(node)].name == dest && !IS_CLOSED(g, STATION_OF_NODE(node))) {
+      target = node;
+      break;
+    }
+    STAT_ADD(&s->stats, COUNT_EDGES_SCANNED, g->edgeStart[node+1] - g->edgeStart[node]);
+    for(int e=g->edgeStart[node]; e<g->edgeStart[node+1]; e++) {
+      if(g->edgeWeight[e] == CLOSED) continue;
+      int dist = s->dist[node] + EDGE_COST(g, node, e);
+      if(dist < s->dist[g->edgeTarget[e]])
+        heapDecrease(s, g->edgeTarget[e], dist, node);
+    }
+  }
+  STAT_ADD(&s->stats, COUNT_NODES_SETTLED, s->numSettled);
+  return target;
+}
+
+// Time of the route to a node settled after its predecessor, from the time of the route to the predecessor
+int getRouteTime(SEARCH* s, int routeTime[], int node) {
+  int pred = s->pred[node];
+  if(pred == -1) return s->dist[node] / COST_SCALE;
+  return routeTime[pred] + (s->dist[node] - s->dist[pred] - (IS_TRANSFER(pred, node) ? TRANSFER_COST : 0)) / COST_SCALE;
+}
+
+
+/*
+ *****************************************************************
+ * Seconds after midnight of a "HH:MM" or "HH:MM:SS" time, -1 if
+ * the text is not a time. Hours go up to 47 for the trips that
+ * run past midnight.
+ *****************************************************************
+ */
+int parseTime(char* text) {
+  int hours = 0, minutes = 0, seconds = 0, length = 0;
+  if(sscanf(text, "%d:%d%n:%d%n", &hours, &minutes, &length, &seconds, &length) < 2 || text[length] != '\0') return -1;
+  if(hours < 0 || hours > 47 || minutes < 0 || minutes > 59 || seconds < 0 || seconds > 59) return -1;
+  return hours*3600 + minutes*60 + seconds;
+}
+
+// Write seconds after midnight as HH:MM:SS
+char* formatTime(int time, char buffer[]) {
+  sprintf(buffer, "%02d:%02d:%02d", time/3600, (time/60)%60, time%60);
+  return buffer;
+}
+
+int compareInt(const void* a, const void* b) {
+  int x = *(const int*) a, y = *(const int*) b;
+  return (x > y) - (x < y);
+}
+
+
+/*
+ *****************************************************************
+ * Read a schedule file for the graph. Every row is
+ *   line towards departure...
+ * where towards is the first or last station of the line and a
+ * departure is a time from the first stop (HH:MM or HH:MM:SS) or
+ * a range with a headway in minutes (HH:MM-HH:MM/minutes). A line
+ * and direction can have many rows. # starts a comment.
+ * Returns NULL with what is wrong written to message.
+ *****************************************************************
+ */
+SCHEDULE* readSchedule(GRAPH* g, char* fileName, STATS* s, char* message, size_t size) {
+
+  STAT_START(loadStart);
+  FILE *file = fopen(fileName, "r");
+  if(file == NULL) {
+    snprintf(message, size, "%s file could not be opened", fileName);
+    return NULL;
+  }
+
+  ARENA *arena = makeArena(s);
+  SCHEDULE *sc = (SCHEDULE*) arenaAlloc(arena, sizeof(SCHEDULE));
+  char row[1024], from[16], to[16];
+  int rowNumber = 0, headway = 0, numOfTrips = 0, maxTrips = 1024;
+  int *tripRoute = (int*) malloc(sizeof(int) * maxTrips), *tripTime = (int*) malloc(sizeof(int) * maxTrips);
+  bool ok = true;
+
+  sc->arena = arena;
+  sc->numOfRoutes = 0;
+  sc->routes = (ROUTE*) arenaAlloc(arena, sizeof(ROUTE) * 2 * g->numOfLines);
+  sc->lineRoutes = (int*) arenaAlloc(arena, sizeof(int) * 2 * g->numOfLines);
+  for(int l=0; l<2*g->numOfLines; l++) sc->lineRoutes[l] = -1;
+
+  while(ok && fgets(row, sizeof(row), file) != NULL) {
+    rowNumber++;
+    char *lineName = strtok(row, " \t\r\n"), *towards = strtok(NULL, " \t\r\n");
+    if(lineName == NULL || lineName[0] == '#') continue;
+
+    int line = lookupName(g->lineNames, lineName);
+    if(line == -1 || towards == NULL) {
+      snprintf(message, size, "Unknown line %s on line %d of %s", lineName, rowNumber, fileName);
+      ok = false;
+      break;
+    }
+    GRAPHLINE *current = &g->lines[line];
+    int name = lookupName(g->stationNames, towards), direction = 0;
+    if(name != -1 && name == g->stations[current->start + current->numOfStations - 1].name) direction = 0;
+    else if(name != -1 && name == g->stations[current->start].name) direction = 1;
+    else {
+      snprintf(message, size, "%s is not an end of %s line on line %d of %s", towards, lineName, rowNumber, fileName);
+      ok = false;
+      break;
+    }
+    int route = sc->lineRoutes[2*line + direction];
+    if(route == -1) {
+      route = sc->lineRoutes[2*line + direction] = sc->numOfRoutes++;
+      sc->routes[route].line = line;
+      sc->routes[route].numOfStops = current->numOfStations;
+      sc->routes[route].numOfTrips = 0;
+    }
+
+    //Departures of the row
+    bool none = true;
+    for(char *token = strtok(NULL, " \t\r\n"); token != NULL && token[0] != '#'; token = strtok(NULL, " \t\r\n")) {
+      int first = -1, last = -1;
+      if(sscanf(token, "%15[0-9:]-%15[0-9:]/%d", from, to, &headway) == 3) {
+        first = parseTime(from);
+        last = parseTime(to);
+        if(headway <= 0) first = -1;
+      }
+      else {
+        first = last = parseTime(token);
+        headway = 1;
+      }
+      if(first == -1 || last == -1 || last < first) {
+        snprintf(message, size, "Bad departure %s on line %d of %s", token, rowNumber, fileName);
+        ok = false;
+        break;
+      }
+      for(int time = first; time <= last; time += headway*60) {
+        if(numOfTrips == maxTrips) {
+          maxTrips *= 2;
+          tripRoute = (int*) realloc(tripRoute, sizeof(int) * maxTrips);
+          tripTime = (int*) realloc(tripTime, sizeof(int) * maxTrips);
+        }
+        tripRoute[numOfTrips] = route;
+        tripTime[numOfTrips++] = time;
+        sc->routes[route].numOfTrips++;
+        if(first == last) break;
+      }
+      none = false;
+    }
+    if(ok && none) {
+      snprintf(message, size, "No departures for %s line towards %s on line %d of %s", lineName, towards, rowNumber, fileName);
+      ok = false;
+    }
+  }
+  fclose(file);
+  if(!ok) {
+    free(tripRoute);
+    free(tripTime);
+    freeArena(arena);
+    return NULL;
+  }
+
+  //Stops and offsets of every route, in the order the train visits them
+  int numOfStops = 0, numOfRouteTrips = 0;
+  for(int r=0; r<sc->numOfRoutes; r++) {
+    sc->routes[r].firstStop = numOfStops;
+    sc->routes[r].firstTrip = numOfRouteTrips;
+    numOfStops += sc->routes[r].numOfStops;
+    numOfRouteTrips += sc->routes[r].numOfTrips;
+  }
+  sc->routeStops = (int*) arenaAlloc(arena, sizeof(int) * numOfStops);
+  sc->arrivalOffset = (int*) arenaAlloc(arena, sizeof(int) * numOfStops);
+  sc->departureOffset = (int*) arenaAlloc(arena, sizeof(int) * numOfStops);
+  for(int l=0; l<2*g->numOfLines; l++) {
+    int r = sc->lineRoutes[l];
+    if(r == -1) continue;
+    GRAPHLINE *current = &g->lines[l/2];
+    int firstId = l%2 == 0 ? current->start : current->start + current->numOfStations - 1;
+    for(int i=0; i<current->numOfStations; i++) {
+      int id = l%2 == 0 ? current->start + i : current->start + current->numOfStations - 1 - i;
+      int stop = sc->routes[r].firstStop + i;
+      sc->routeStops[stop] = id;
+      sc->arrivalOffset[stop] = i == 0 ? 0 : RIDE_TIME(&g->stations[firstId], &g->stations[id]);
+      sc->departureOffset[stop] = i == 0 ? 0 : sc->arrivalOffset[stop] + g->stations[id].stopTime;
+    }
+  }
+
+  //Trips grouped by route and sorted
+  int *fill = (int*) malloc(sizeof(int) * (sc->numOfRoutes + 1));
+  sc->tripDepartures = (int*) arenaAlloc(arena, sizeof(int) * (numOfTrips + 1));
+  for(int r=0; r<sc->numOfRoutes; r++) fill[r] = sc->routes[r].firstTrip;
+  for(int t=0; t<numOfTrips; t++) sc->tripDepartures[fill[tripRoute[t]]++] = tripTime[t];
+  for(int r=0; r<sc->numOfRoutes; r++)
+    qsort(&sc->tripDepartures[sc->routes[r].firstTrip], sc->routes[r].numOfTrips, sizeof(int), compareInt);
+
+  free(fill);
+  free(tripRoute);
+  free(tripTime);
+  STAT_STOP(s, PHASE_LOAD, loadStart);
+  return sc;
+}
+
+void freeSchedule(SCHEDULE* sc) {
+  freeArena(sc->arena);
+}
+
+
+// Set a new (earlier) arrival at a station in round k and mark it
+void setArrival(RAPTORSEARCH* r, int k, int station, int time, int boardStop, int boardTrip) {
+  size_t at = (size_t) k * r->numOfStations + station;
+  if(r->best[station] == NO_TIME) r->touched[r->numTouched++] = station;
+  r->arrival[at] = r->best[station] = time;
+  r->boardStop[at] = boardStop;
+  r->boardTrip[at] = boardTrip;
+  if(!r->isMarked[station]) {
+    r->isMarked[station] = true;
+    r->marked[r->numMarked++] = station;
+  }
+}
+
+// Queue the routes through a station, from its position on them
+void queueRoutes(GRAPH* g, SCHEDULE* sc, RAPTORSEARCH* r, int station) {
+  GRAPHLINE *current = &g->lines[g->stations[station].line];
+  for(int d=0; d<2; d++) {
+    int route = sc->lineRoutes[2*g->stations[station].line + d];
+    if(route == -1) continue;
+    int position = d == 0 ? station - current->start : current->start + current->numOfStations - 1 - station;
+    if(r->routeStart[route] == -1) {
+      r->queuedRoutes[r->numQueued++] = route;
+      r->routeStart[route] = position;
+    }
+    else if(position < r->routeStart[route]) r->routeStart[route] = position;
+  }
+}
+
+
+/*
+ *****************************************************************
+ * RAPTOR: earliest arrival at a station with the destination name
+ * when leaving from any station with the source name at the given
+ * time. Round k scans the routes through the stations improved in
+ * round k-1, riding the earliest trip that can be caught, and then
+ * walks the transfers of the stations it improved. Returns the
+ * station reached and sets the number of rides, -1 if the
+ * destination cannot be reached that day.
+ *****************************************************************
+ */
+int findEarliestArrival(GRAPH* g, SCHEDULE* sc, SEARCH* s, int source, int dest, int departure, int* rides) {
+
+  RAPTORSEARCH *r = s->raptor;
+  int n = r->numOfStations, bestDest = NO_TIME, target = -1;
+
+  for(int i=0; i<r->numTouched; i++) {
+    int station = r->touched[i];
+    r->best[station] = NO_TIME;
+    for(int k=0; k<=MAX_RIDES; k++) r->arrival[(size_t) k*n + station] = NO_TIME;
+  }
+  r->numTouched = 0;
+  r->numMarked = 0;
+  for(int i=g->nameStart[source]; i<g->nameStart[source+1]; i++)
+    setArrival(r, 0, g->nameStations[i], departure, -1, -1);
+
+  for(int k=1; k<=MAX_RIDES && r->numMarked > 0; k++) {
+    int *previous = &r->arrival[(size_t) (k-1)*n];
+
+    //What was reached with fewer rides is reached with k rides too
+    for(int i=0; i<r->numTouched; i++) {
+      size_t at = (size_t) k*n + r->touched[i];
+      r->arrival[at] = previous[r->touched[i]];
+      r->boardTrip[at] = -2;
+    }
+
+    r->numQueued = 0;
+    for(int m=0; m<r->numMarked; m++) {
+      queueRoutes(g, sc, r, r->marked[m]);
+      r->isMarked[r->marked[m]] = false;
+    }
+    r->numMarked = 0;
+
+    //Ride every queued route from the first station improved on it
+    for(int q=0; q<r->numQueued; q++) {
+      ROUTE *route = &sc->routes[r->queuedRoutes[q]];
+      int trip = -1, boardAt = -1;
+      int *trips = &sc->tripDepartures[route->firstTrip];
+      for(int i=r->routeStart[r->queuedRoutes[q]]; i<route->numOfStops; i++) {
+        int stop = route->firstStop + i, station = sc->routeStops[stop];
+        if(trip != -1) {
+          int time = trips[trip] + sc->arrivalOffset[stop];
+          if(time < r->best[station] && time < bestDest) {
+            setArrival(r, k, station, time, boardAt, route->firstTrip + trip);
+            if(g->stations[station].name == dest) bestDest = time;
+          }
+        }
+        //Catch an earlier trip here if the station was reached in time for it
+        if(previous[station] != NO_TIME && (trip == -1 || previous[station] < trips[trip] + sc->departureOffset[stop])) {
+          int low = 0, high = trip == -1 ? route->numOfTrips : trip;
+          while(low < high) {
+            int middle = (low + high) / 2;
+            if(trips[middle] + sc->departureOffset[stop] < previous[station]) low = middle + 1;
+            else high = middle;
+          }
+          if(low < (trip == -1 ? route->numOfTrips : trip)) {
+            trip = low;
+            boardAt = i;
+          }
+        }
+      }
+      r->routeStart[r->queuedRoutes[q]] = -1;
+    }
+
+    //Transfers from the stations reached in this round
+    int numReached = r->numMarked;
+    for(int m=0; m<numReached; m++) {
+      GRAPHSTATION *station = &g->stations[r->marked[m]];
+      int time = r->arrival[(size_t) k*n + r->marked[m]];
+      for(int t=station->firstTransfer; t<station->firstTransfer+station->numOfTransfers; t++) {
+        int other = g->transfers[t].station;
+        if(time + g->transfers[t].transferTime < r->best[other] && time + g->transfers[t].transferTime < bestDest)
+          setArrival(r, k, other, time + g->transfers[t].transferTime, r->marked[m], -1);
+      }
+    }
+  }
+
+  //Earliest arrival, with the fewest rides that give it
+  int earliest = NO_TIME;
+  for(int k=1; k<=MAX_RIDES; k++) {
+    for(int i=g->nameStart[dest]; i<g->nameStart[dest+1]; i++) {
+      int time = r->arrival[(size_t) k*n + g->nameStations[i]];
+      if(time < earliest) {
+        earliest = time;
+        target = g->nameStations[i];
+        *rides = k;
+      }
+    }
+  }
+  for(int m=0; m<r->numMarked; m++) r->isMarked[r->marked[m]] = false;
+  r->numMarked = 0;
+  return target;
+}
+
+
+/*
+ *****************************************************************
+ * Follow the rides of a timetable search back from the target
+ * station and store one leg per ride, with its times. Returns
+ * the number of legs.
+ *****************************************************************
+ */
+int getTimedLegs(SCHEDULE* sc, RAPTORSEARCH* r, int target, int rides, LEG legs[]) {
+
+  int station = target, numOfLegs = 0;
+  for(int k=rides; k>0; ) {
+    size_t at = (size_t) k * r->numOfStations + station;
+    if(r->boardTrip[at] == -2) { //Reached with fewer rides
+      k--;
+      continue;
+    }
+    if(r->boardTrip[at] == -1) { //Transfer, same round
+      station = r->boardStop[at];
+      continue;
+    }
+    int trip = r->boardTrip[at], low = 0, high = sc->numOfRoutes - 1;
+    while(low < high) { //Route of the trip
+      int middle = (low + high + 1) / 2;
+      if(sc->routes[middle].firstTrip <= trip) low = middle;
+      else high = middle - 1;
+    }
+    int stop = sc->routes[low].firstStop + r->boardStop[at];
+    LEG *leg = &legs[numOfLegs++];
+    leg->from = sc->routeStops[stop];
+    leg->to = station;
+    leg->departure = sc->tripDepartures[trip] + sc->departureOffset[stop];
+    leg->arrival = r->arrival[at];
+    station = leg->from;
+    k--;
+  }
+  for(int i=0; i<numOfLegs/2; i++) {
+    LEG leg = legs[i];
+    legs[i] = legs[numOfLegs-1-i];
+    legs[numOfLegs-1-i] = leg;
+  }
+  return numOfLegs;
+}
+
+
+/*
+ *****************************************************************
+ * Follow the predecessors back from the target node and store
+ * the path from source to target. Returns the path length.
+ *****************************************************************
+ */
+int getPath(int pred[], int target, int path[]) {
+
+  int pathLength = 0;
+
+  for(int node = target; node != -1; node = pred[node])
+    path[pathLength++] = node;
+  for(int i=0; i<pathLength/2; i++) {
+    int node = path[i];
+    path[i] = path[pathLength-1-i];
+    path[pathLength-1-i] = node;
+  }
+  return pathLength;
+}
+
+
+/*
+ *****************************************************************
+ * Split a path into legs. A new leg starts after every transfer
+ * edge. Returns the number of legs.
+ *****************************************************************
+ */
+int getLegs(int path[], int pathLength, LEG legs[]) {
+
+  int numOfLegs = 0;
+
+  legs[0].from = STATION_OF_NODE(path[0]);
+  for(int i=1; i<pathLength; i++) {
+    int a = STATION_OF_NODE(path[i-1]), b = STATION_OF_NODE(path[i]);
+    if(IS_ARRIVAL(path[i-1]) && a != b) {
+      legs[numOfLegs++].to = a;
+      legs[numOfLegs].from = b;
+    }
+  }
+  legs[numOfLegs++].to = STATION_OF_NODE(path[pathLength-1]);
+  return numOfLegs;
+}
+
+
+// Fill in the names and the number of stations of the legs from the graph
+void describeLegs(GRAPH* g, LEG legs[], int numOfLegs) {
+  for(int i=0; i<numOfLegs; i++) {
+    GRAPHSTATION *from = &g->stations[legs[i].from], *to = &g->stations[legs[i].to];
+    GRAPHLINE *current = &g->lines[from->line];
+    legs[i].lineName = g->lineNames->names[from->line];
+    legs[i].fromStation = g->stationNames->names[from->name];
+    legs[i].toStation = g->stationNames->names[to->name];
+    if(getDirection(from, to) == 1)
+      legs[i].towards = g->stationNames->names[g->stations[current->start].name];
+    else
+      legs[i].towards = g->stationNames->names[g->stations[current->start + current->numOfStations - 1].name];
+    legs[i].numOfStations = abs(to->stationNumber - from->stationNumber);
+    legs[i].rideTime = RIDE_TIME(from, to);
+  }
+}
+
+/*
+ *****************************************************************
+ * Dijkstra for a spur of Yen's algorithm: from the spur node,
+ * reached at spurTime, or with spur -1 from the departure nodes
+ * of the source name, to the first arrival node of dest. The
+ * banned nodes are not taken from the spur node (not started from
+ * with spur -1), stamped names are not entered from another
+ * station, so the spur can still dwell or transfer where it is,
+ * and the search gives up past limit. Returns the arrival node or
+ * -1.
+ *****************************************************************
+ */
+int findSpurPath(GRAPH* g, SEARCH* s, ALTERNATIVES* a, int source, int spur, int spurTime, int dest, int limit) {
+
+  int target = -1;
+
+  resetSearch(s);
+  if(spur == -1) {
+    for(int i=g->nameStart[source]; i<g->nameStart[source+1]; i++) {
+      int node = DEPARTURE(g->nameStations[i]), banned = 0;
+      while(banned < a->numBanned && a->banned[banned] != node) banned++;
+      if(!IS_CLOSED(g, g->nameStations[i]) && banned == a->numBanned) heapDecrease(s, node, 0, -1);
+    }
+  }
+  else heapDecrease(s, spur, spurTime, -1);
+
+  while(s->heapSize > 0 && s->dist[s->heap[0]] <= limit) {
+    int node = heapPop(s);
+    s->settled[s->numSettled++] = node;
+    if(IS_ARRIVAL(node) && g->stations[STATION_OF_NODE(node)].name == dest && !IS_CLOSED(g, STATION_OF_NODE(node))) {
+      target = node;
+      break;
+    }
+    STAT_ADD(&s->stats, COUNT_EDGES_SCANNED, g->edgeStart[node+1] - g->edgeStart[node]);
+    for(int e=g->edgeStart[node]; e<g->edgeStart[node+1]; e++) {
+      int next = g->edgeTarget[e], name = g->stations[STATION_OF_NODE(next)].name, banned = 0;
+      if(g->edgeWeight[e] == CLOSED) continue;
+      if(a->nameStamp[name] == a->stamp && name != g->stations[STATION_OF_NODE(node)].name) continue;
+      if(node == spur) {
+        while(banned < a->numBanned && a->banned[banned] != next) banned++;
+        if(banned < a->numBanned) continue;
+      }
+      int dist = s->dist[node] + EDGE_COST(g, node, e);
+      if(dist < s->dist[next])
+        heapDecrease(s, next, dist, node);
+    }
+  }
+  STAT_ADD(&s->stats, COUNT_NODES_SETTLED, s->numSettled);
+  return target;
+}
+
+/*
+ *****************************************************************
+ * Add the route made of the first rootLength nodes of the route
+ * parent and the spur path that search s found to target as a
+ * candidate. It is thrown away if it goes back to a station it
+ * left or is the same as a route already known.
+ *****************************************************************
+ */
+void addCandidate(GRAPH* g, SEARCH* s, ALTERNATIVES* a, int parent, int rootLength, int target) {
+
+  int spurLength = getPath(s->pred, target, s->path);
+  int length = rootLength + spurLength, start = a->numOfNodes;
+  if(rootLength > 0) length--; //The spur node ends the root and starts the spur path
+
+  if(a->numOfNodes + length > a->maxNodes) {
+    while(a->numOfNodes + length > a->maxNodes) a->maxNodes *= 2;
+    a->nodes = (int*) realloc(a->nodes, sizeof(int) * a->maxNodes);
+    a->times = (int*) realloc(a->times, sizeof(int) * a->maxNodes);
+  }
+  if(rootLength > 0) {
+    memcpy(&a->nodes[start], &a->nodes[a->paths[parent].start], sizeof(int) * (rootLength-1));
+    memcpy(&a->times[start], &a->times[a->paths[parent].start], sizeof(int) * (rootLength-1));
+  }
+  for(int i=0; i<spurLength; i++) {
+    a->nodes[start + length - spurLength + i] = s->path[i];
+    a->times[start + length - spurLength + i] = s->dist[s->path[i]];
+  }
+
+  //Every station name has its nodes next to each other on a route without a loop
+  a->stamp++;
+  for(int i=0, last = -1; i<length; i++) {
+    int name = g->stations[STATION_OF_NODE(a->nodes[start+i])].name;
+    if(name == last) continue;
+    if(a->nameStamp[name] == a->stamp) return;
+    a->nameStamp[name] = a->stamp;
+    last = name;
+  }
+  for(int p=0; p<a->numOfPaths; p++) {
+    if(a->paths[p].length == length && memcmp(&a->nodes[a->paths[p].start], &a->nodes[start], sizeof(int) * length) == 0)
+      return;
+  }
+
+  if(a->numOfPaths == a->maxPaths) {
+    a->maxPaths *= 2;
+    a->paths = (ALTPATH*) realloc(a->paths, sizeof(ALTPATH) * a->maxPaths);
+  }
+  ALTPATH *path = &a->paths[a->numOfPaths++];
+  path->start = start;
+  path->length = length;
+  path->deviation = rootLength - 1;
+  path->accepted = false;
+  a->numOfNodes += length;
+}
+
+// Time of the route or candidate p
+#define PATH_TIME(a, p) ((a)->times[(a)->paths[p].start + (a)->paths[p].length - 1])
+
+/*
+ *****************************************************************
+ * No candidate slower than the needed fastest ones can be taken,
+ * so a spur search need not look further than the slowest of
+ * them. INT_MAX while there are fewer candidates than needed.
+ *****************************************************************
+ */
+int getSpurLimit(ALTERNATIVES* a, int needed) {
+  int fastest[MAX_ALTERNATIVES], numFastest = 0;
+  for(int p=0; p<a->numOfPaths; p++) {
+    if(a->paths[p].accepted) continue;
+    int time = PATH_TIME(a, p), i = numFastest < needed ? numFastest++ : needed;
+    while(i > 0 && fastest[i-1] > time) {
+      if(i < needed) fastest[i] = fastest[i-1];
+      i--;
+    }
+    if(i < needed) fastest[i] = time;
+  }
+  return numFastest < needed ? INT_MAX : fastest[needed-1];
+}
+
+/*
+ *****************************************************************
+ * Yen's algorithm for the k fastest routes without loops from
+ * the source name to the dest name. The fastest candidate becomes
+ * the next route, then every node of it from where it left its
+ * parent is a spur node: the route is kept up to there and a new
+ * path is searched from there, not taking the next node of any
+ * route with the same start nor going back to the stations it has
+ * been through. The one SEARCH is reset between spur searches, only the
+ * nodes they touched. Returns the number of routes found.
+ *****************************************************************
+ */
+int findAlternatives(GRAPH* g, SEARCH* s, ALTERNATIVES* a, int source, int dest, int k) {
+
+  a->numOfNodes = a->numOfPaths = a->numAccepted = a->numBanned = 0;
+  a->stamp++;
+  int target = findSpurPath(g, s, a, source, -1, 0, dest, INT_MAX);
+  if(target != -1) addCandidate(g, s, a, -1, 0, target);
+
+  while(a->numAccepted < k) {
+    int best = -1;
+    for(int p=0; p<a->numOfPaths; p++)
+      if(!a->paths[p].accepted && (best == -1 || PATH_TIME(a, p) < PATH_TIME(a, best))) best = p;
+    if(best == -1) break;
+    a->paths[best].accepted = true;
+    a->accepted[a->numAccepted++] = best;
+    if(a->numAccepted == k) break;
+
+    for(int i=a->paths[best].deviation; i<a->paths[best].length - 1; i++) {
+      int *root = &a->nodes[a->paths[best].start], spur = i == -1 ? -1 : root[i];
+
+      a->numBanned = 0;
+      for(int r=0; r<a->numAccepted; r++) {
+        ALTPATH *route = &a->paths[a->accepted[r]];
+        if(route->length > i+1 && memcmp(&a->nodes[route->start], root, sizeof(int) * (i+1)) == 0)
+          a->banned[a->numBanned++] = a->nodes[route->start + i+1];
+      }
+      a->stamp++;
+      a->nameStamp[source] = a->stamp;
+      for(int j=0; j<=i; j++)
+        a->nameStamp[g->stations[STATION_OF_NODE(root[j])].name] = a->stamp;
+
+      int spurTime = i == -1 ? 0 : a->times[a->paths[best].start + i];
+      target = findSpurPath(g, s, a, source, spur, spurTime, dest, getSpurLimit(a, k - a->numAccepted));
+      if(target != -1) addCandidate(g, s, a, best, i+1, target);
+    }
+  }
+  return a->numAccepted;
+}
+
+
+/*
+ *****************************************************************
+ * Dijkstra over the labels (node, transfers) of the search s, for
+ * the routes from the source name to the dest name that no other
+ * route beats on both time and transfers. A transfer edge moves to
+ * the next label. A label is dropped when a label of the same node
+ * with no more transfers is as fast, and once a route is found, so
+ * is every label with as many transfers as it. targets gets the
+ * destination labels, fastest first. Returns how many there are.
+ *****************************************************************
+ */
+int findParetoPaths(GRAPH* g, SEARCH* s, int source, int dest, int targets[]) {
+
+  int found = 0, maxTransfers = PARETO_LABELS - 1;
+
+  resetSearch(s);
+  for(int i=g->nameStart[source]; i<g->nameStart[source+1]; i++)
+    if(!IS_CLOSED(g, g->nameStations[i])) heapDecrease(s, LABEL(DEPARTURE(g->nameStations[i]), 0), 0, -1);
+
+  while(s->heapSize > 0) {
+    int label = heapPop(s), node = label / PARETO_LABELS, transfers = label % PARETO_LABELS, dominated = 0;
+    while(dominated < transfers && s->dist[LABEL(node, dominated)] > s->dist[label]) dominated++;
+    if(transfers > maxTransfers || dominated < transfers) continue;
+    s->settled[s->numSettled++] = label;
+
+    if(IS_ARRIVAL(node) && g->stations[STATION_OF_NODE(node)].name == dest && !IS_CLOSED(g, STATION_OF_NODE(node))) {
+      if(found > 0 && s->dist[targets[found-1]] == s->dist[label]) found--; //As fast with fewer transfers
+      targets[found++] = label;
+      if(transfers == 0) break;
+      maxTransfers = transfers - 1;
+      continue;
+    }
+
+    STAT_ADD(&s->stats, COUNT_EDGES_SCANNED, g->edgeStart[node+1] - g->edgeStart[node]);
+    for(int e=g->edgeStart[node]; e<g->edgeStart[node+1]; e++) {
+      if(g->edgeWeight[e] == CLOSED) continue;
+      int next = g->edgeTarget[e], dist = s->dist[label] + g->edgeWeight[e];
+      int t = transfers + (IS_ARRIVAL(node) && STATION_OF_NODE(next) != STATION_OF_NODE(node)), fewer = 0;
+      if(t > maxTransfers) continue;
+      while(fewer <= t && s->dist[LABEL(next, fewer)] > dist) fewer++;
+      if(fewer > t) heapDecrease(s, LABEL(next, t), dist, label);
+    }
+  }
+  STAT_ADD(&s->stats, COUNT_NODES_SETTLED, s->numSettled);
+  return found;
+}
+
+
+/*
+ ***********************************************************************
+ * Itinerary records (--format). A route is rendered once, into the
+ * record buffer of the search, and written to its output with a single
+ * fwrite, so a batch pays for one formatting pass per trip and the
+ * stdio buffer only sees whole records.
+ * text - the sentences of the planner, as it always wrote them
+ * json - one JSON object per route and per error (JSON Lines)
+ * csv - one row per leg and per error, under CSV_HEADER
+ * binary - a RECORDFILEHEADER at the start of the file, then for every
+ * route a RECORDHEADER and a RECORDLEG for every leg
+ ***********************************************************************
+ */
+typedef struct {
+  char magic[4];
+  int version;
+} RECORDFILEHEADER;
+
+typedef struct {
+  int status; //QUERY_OK, or the QUERY_ code of the error
+  int route; //Route number, 1 without --alternatives or --pareto. Line number of the query for an error.
+  int numOfLegs; //RECORDLEGs that follow, 0 for an error
+  int totalTime;
+} RECORDHEADER;
+
+typedef struct {
+  int line; //Line id, and name ids of the stations, in the order of the network file
+  int from;
+  int to;
+  int towards;
+  int numOfStations;
+  int rideTime;
+  int departure; //-1 without a schedule
+  int arrival;
+} RECORDLEG;
+
+char *formatNames[] = {"text", "json", "csv", "binary"};
+
+// Write what comes before the first record of a file: the CSV header, or the header of the binary records
+void writeRecordsHeader(FILE* file) {
+  RECORDFILEHEADER header;
+  if(outputFormat == FORMAT_CSV) fputs(CSV_HEADER, file);
+  if(outputFormat != FORMAT_BINARY) return;
+  memcpy(header.magic, RECORD_MAGIC, 4);
+  header.version = RECORD_VERSION;
+  fwrite(&header, sizeof(header), 1, file);
+}
+
+// Format of a --format name, -1 if there is no such format
+int parseFormat(char* name) {
+  for(int f=FORMAT_TEXT; f<=FORMAT_BINARY; f++)
+    if(strcmp(name, formatNames[f]) == 0) return f;
+  return -1;
+}
+
+// Make room for length more bytes in the record of a search
+void growRecord(SEARCH* s, size_t length) {
+  if(s->recordLength + length <= s->recordCapacity) return;
+  s->recordCapacity = 2*(s->recordLength + length);
+  s->record = (char*) realloc(s->record, s->recordCapacity);
+  if(s->record == NULL) {
+    printf("\nOut of memory\n");
+    exit(0);
+  }
+}
+
+void recordBytes(SEARCH* s, const void* bytes, size_t length) {
+  growRecord(s, length);
+  memcpy(s->record + s->recordLength, bytes, length);
+  s->recordLength += length;
+}
+
+void recordText(SEARCH* s, const char* text) {
+  recordBytes(s, text, strlen(text));
+}
+
+void recordInt(SEARCH* s, int n) {
+  char digits[12];
+  int i = sizeof(digits);
+  unsigned int u = n < 0 ? 0u - (unsigned int) n : (unsigned int) n;
+  do {
+    digits[--i] = '0' + u % 10;
+    u /= 10;
+  } while(u > 0);
+  if(n < 0) digits[--i] = '-';
+  recordBytes(s, digits + i, sizeof(digits) - i);
+}
+
+void recordTime(SEARCH* s, int time) {
+  char buffer[16];
+  recordText(s, formatTime(time, buffer));
+}
+
+void recordJsonString(SEARCH* s, const char* text) {
+  recordBytes(s, "\"", 1);
+  for(const char *c = text; *c != '\0'; c++) {
+    char escaped[8];
+    if(*c == '"' || *c == '\\') {
+      escaped[0] = '\\';
+      escaped[1] = *c;
+      recordBytes(s, escaped, 2);
+    }
+    else if((unsigned char) *c < 0x20) {
+      snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char) *c);
+      recordText(s, escaped);
+    }
+    else recordBytes(s, c, 1);
+  }
+  recordBytes(s, "\"", 1);
+}
+
+// A CSV field, quoted if it holds a comma, a quote or a line break
+void recordCsvField(SEARCH* s, const char* text) {
+  if(strpbrk(text, ",\"\r\n") == NULL) {
+    recordText(s, text);
+    return;
+  }
+  recordBytes(s, "\"", 1);
+  for(const char *c = text; *c != '\0'; c++) {
+    if(*c == '"') recordBytes(s, "\"", 1);
+    recordBytes(s, c, 1);
+  }
+  recordBytes(s, "\"", 1);
+}
+
+// Write the record to the output of the search and empty it. Returns the number of bytes written.
+int flushRecord(SEARCH* s) {
+  int written = (int) fwrite(s->record, 1, s->recordLength, s->output);
+  s->recordLength = 0;
+  return written;
+}
+
+// Ids of the line and the station names of a leg, from the table or the graph of a network
+void getLegIds(NETWORK* n, LEG* leg, RECORDLEG* ids) {
+  TABLE *table = n->table;
+  GRAPH *graph = n->graph;
+  if(table != NULL) {
+    TABLESTATION *a = &table->stations[leg->from], *b = &table->stations[leg->to];
+    ids->line = a->line;
+    ids->from = a->name;
+    ids->to = b->name;
+    ids->towards = a->stationNumber > b->stationNumber ? table->lines[a->line].start : table->lines[a->line].end;
+  }
+  else {
+    GRAPHSTATION *a = &graph->stations[leg->from], *b = &graph->stations[leg->to];
+    GRAPHLINE *line = &graph->lines[a->line];
+    ids->line = a->line;
+    ids->from = a->name;
+    ids->to = b->name;
+    ids->towards = graph->stations[a->stationNumber > b->stationNumber ? line->start : line->start + line->numOfStations - 1].name;
+  }
+}
+
+void recordTextItinerary(SEARCH* s, LEG legs[], int numOfLegs, int totalTime, bool timed, int route, int numOfRoutes) {
+
+  if(numOfRoutes > 0) {
+    recordText(s, "Route ");
+    recordInt(s, route);
+    recordText(s, " of ");
+    recordInt(s, numOfRoutes);
+    recordText(s, " with ");
+    recordInt(s, numOfLegs-1);
+    recordText(s, numOfLegs == 2 ? " transfer:\n" : " transfers:\n");
+  }
+
+  for(int i=0; i<numOfLegs; i++) {
+    LEG *leg = &legs[i];
+
+    //First leg, then a transfer and a ride on the next line for every other leg
+    if(i == 0) {
+      recordText(s, "Start from ");
+      recordText(s, leg->fromStation);
+      recordText(s, " station on ");
+    }
+    else {
+      recordText(s, "\nTransfer to ");
+      recordText(s, leg->lineName);
+      recordText(s, " line.\nTake ");
+    }
+    recordText(s, leg->lineName);
+    recordText(s, " line towards ");
+    recordText(s, leg->towards);
+    if(timed) {
+      recordText(s, " at ");
+      recordTime(s, leg->departure);
+    }
+    recordText(s, " for ");
+    recordInt(s, leg->numOfStations);
+    recordText(s, numOfLegs == 1 && !timed ? " stations to arrive at " : " stations to reach "); //No transfer required
+    recordText(s, leg->toStation);
+    if(timed) {
+      recordText(s, " at ");
+      recordTime(s, leg->arrival);
+    }
+    recordText(s, ".");
+  }
+
+  if(timed) {
+    recordText(s, "\nArrive at ");
+    recordTime(s, legs[numOfLegs-1].arrival);
+    recordText(s, " with ");
+    recordInt(s, numOfLegs-1);
+    recordText(s, numOfLegs == 2 ? " transfer." : " transfers.");
+  }
+  recordText(s, "\nTotal duration of journey: ");
+  recordInt(s, totalTime/60);
+  recordText(s, " minutes ");
+  recordInt(s, totalTime%60);
+  recordText(s, numOfLegs == 1 && !timed ? " seconds\n" : " seconds.\n");
+}
+
+void recordJsonItinerary(SEARCH* s, LEG legs[], int numOfLegs, int totalTime, bool timed, int route, int numOfRoutes) {
+
+  recordText(s, "{");
+  if(numOfRoutes > 0) {
+    recordText(s, "\"route\":");
+    recordInt(s, route);
+    recordText(s, ",\"routes\":");
+    recordInt(s, numOfRoutes);
+    recordText(s, ",");
+  }
+  recordText(s, "\"seconds\":");
+  recordInt(s, totalTime);
+  recordText(s, ",\"transfers\":");
+  recordInt(s, numOfLegs-1);
+  recordText(s, ",\"legs\":[");
+  for(int i=0; i<numOfLegs; i++) {
+    LEG *leg = &legs[i];
+    recordText(s, i == 0 ? "{\"line\":" : ",{\"line\":");
+    recordJsonString(s, leg->lineName);
+    recordText(s, ",\"from\":");
+    recordJsonString(s, leg->fromStation);
+    recordText(s, ",\"to\":");
+    recordJsonString(s, leg->toStation);
+    recordText(s, ",\"towards\":");
+    recordJsonString(s, leg->towards);
+    recordText(s, ",\"stations\":");
+    recordInt(s, leg->numOfStations);
+    recordText(s, ",\"seconds\":");
+    recordInt(s, leg->rideTime);
+    if(timed) {
+      recordText(s, ",\"departure\":\"");
+      recordTime(s, leg->departure);
+      recordText(s, "\",\"arrival\":\"");
+      recordTime(s, leg->arrival);
+      recordText(s, "\"");
+    }
+    recordText(s, "}");
+  }
+  recordText(s, "]}\n");
+}
+
+void recordCsvItinerary(SEARCH* s, LEG legs[], int numOfLegs, int totalTime, bool timed, int route) {
+
+  for(int i=0; i<numOfLegs; i++) {
+    LEG *leg = &legs[i];
+    recordInt(s, route);
+    recordText(s, ",");
+    recordInt(s, i+1);
+    recordText(s, ",");
+    recordCsvField(s, leg->lineName);
+    recordText(s, ",");
+    recordCsvField(s, leg->fromStation);
+    recordText(s, ",");
+    recordCsvField(s, leg->toStation);
+    recordText(s, ",");
+    recordCsvField(s, leg->towards);
+    recordText(s, ",");
+    recordInt(s, leg->numOfStations);
+    recordText(s, ",");
+    recordInt(s, leg->rideTime);
+    recordText(s, ",");
+    if(timed) recordTime(s, leg->departure);
+    recordText(s, ",");
+    if(timed) recordTime(s, leg->arrival);
+    recordText(s, ",");
+    recordInt(s, totalTime);
+    recordText(s, ",\n");
+  }
+}
+
+void recordBinaryItinerary(SEARCH* s, LEG legs[], int numOfLegs, int totalTime, bool timed, int route) {
+
+  RECORDHEADER header = {QUERY_OK, route, numOfLegs, totalTime};
+  recordBytes(s, &header, sizeof(header));
+  for(int i=0; i<numOfLegs; i++) {
+    RECORDLEG leg;
+    getLegIds(s->network, &legs[i], &leg);
+    leg.numOfStations = legs[i].numOfStations;
+    leg.rideTime = legs[i].rideTime;
+    leg.departure = timed ? legs[i].departure : -1;
+    leg.arrival = timed ? legs[i].arrival : -1;
+    recordBytes(s, &leg, sizeof(leg));
+  }
+}
+
+
+/*
+ ***************************************************************
+ * Write a route to the output of the search in the format of
+ * --format. timed routes come from the timetable and have the
+ * time every train leaves and arrives. Route route of
+ * numOfRoutes, numOfRoutes 0 for a query with one route.
+ * Returns the number of bytes written.
+ ***************************************************************
+ */
+int writeItinerary(SEARCH* s, LEG legs[], int numOfLegs, int totalTime, bool timed, int route, int numOfRoutes) {
+
+  switch(outputFormat) {
+    case FORMAT_TEXT:
+      recordTextItinerary(s, legs, numOfLegs, totalTime, timed, route, numOfRoutes);
+      break;
+    case FORMAT_JSON:
+      recordJsonItinerary(s, legs, numOfLegs, totalTime, timed, route, numOfRoutes);
+      break;
+    case FORMAT_CSV:
+      recordCsvItinerary(s, legs, numOfLegs, totalTime, timed, numOfRoutes > 0 ? route : 1);
+      break;
+    case FORMAT_BINARY:
+      recordBinaryItinerary(s, legs, numOfLegs, totalTime, timed, numOfRoutes > 0 ? route : 1);
+      break;
+  }
+  return flushRecord(s);
+}
+
+// Write the error of a query line, as an error record in the json, csv and binary formats
+void writeQueryError(SEARCH* s, int status, int lineNumber, char* message) {
+
+  char text[2*MAX_QUERY_LENGTH];
+  snprintf(text, sizeof(text), "Error on line %d: %s", lineNumber, message);
+  switch(outputFormat) {
+    case FORMAT_TEXT:
+      recordText(s, text);
+      recordText(s, "\n");
+      break;
+    case FORMAT_JSON:
+      recordText(s, "{\"query_line\":");
+      recordInt(s, lineNumber);
+      recordText(s, ",\"error\":");
+      recordJsonString(s, message);
+      recordText(s, "}\n");
+      break;
+    case FORMAT_CSV:
+      recordText(s, ",,,,,,,,,,,");
+      recordCsvField(s, text);
+      recordText(s, "\n");
+      break;
+    case FORMAT_BINARY: {
+      RECORDHEADER header = {status, lineNumber, 0, 0};
+      recordBytes(s, &header, sizeof(header));
+      break;
+    }
+  }
+  flushRecord(s);
+}
+
+
+/*
+ ******************************************************************
+ * FNV-1a hash of the edges of a graph. A table or a hierarchy file
+ * keeps it so that it is only used with the network it was made for.
+ ******************************************************************
+ */
+unsigned int hashEdges(GRAPH* g) {
+  unsigned int hash = 2166136261u;
+  for(int n=0; n<=g->numOfNodes; n++) hash = (hash ^ (unsigned int) g->edgeStart[n]) * 16777619u;
+  for(int e=0; e<g->numOfEdges; e++) {
+    hash = (hash ^ (unsigned int) g->edgeTarget[e]) * 16777619u;
+    hash = (hash ^ (unsigned int) g->edgeWeight[e]) * 16777619u;
+  }
+  return hash;
+}
+
+/*
+ ******************************************************************
+ * Run the search from every station name and write the table file.
+ ******************************************************************
+ */
+void precomputeTable(GRAPH* g, char* fileName) {
+
+  int numOfNames = g->numOfNames, stringPoolSize = 0;
+  int *nameOffset = (int*) malloc(sizeof(int) * numOfNames);
+  TABLELINE *lines = (TABLELINE*) malloc(sizeof(TABLELINE) * g->numOfLines);
+  TABLESTATION *stations = (TABLESTATION*) malloc(sizeof(TABLESTATION) * g->numOfStations);
+  TABLEHEADER header;
+  SEARCH *search = makeSearch(g->numOfNodes);
+
+  //The table uses the same name ids as the graph. Place the names in the string pool.
+  for(int n=0; n<numOfNames; n++) {
+    nameOffset[n] = stringPoolSize;
+    stringPoolSize += strlen(g->stationNames->names[n]) + 1;
+  }
+  for(int i=0; i<g->numOfLines; i++) {
+    lines[i].name = stringPoolSize;
+    lines[i].start = g->stations[g->lines[i].start].name;
+    lines[i].end = g->stations[g->lines[i].start + g->lines[i].numOfStations - 1].name;
+    stringPoolSize += strlen(g->lineNames->names[i]) + 1;
+  }
+  for(int id=0; id<g->numOfStations; id++) {
+    stations[id].name = g->stations[id].name;
+    stations[id].line = g->stations[id].line;
+    stations[id].stationNumber = g->stations[id].stationNumber;
+    stations[id].stopTime = g->stations[id].stopTime;
+    stations[id].rideClock = g->stations[id].rideClock;
+  }
+
+  int *time = (int*) malloc(sizeof(int) * (size_t) numOfNames * numOfNames);
+  int *target = (int*) malloc(sizeof(int) * (size_t) numOfNames * numOfNames);
+  int *pred = (int*) malloc(sizeof(int) * (size_t) numOfNames * g->numOfNodes);
+  int *routeTime = (int*) malloc(sizeof(int) * g->numOfNodes);
+  if(time == NULL || target == NULL || pred == NULL || routeTime == NULL) {
+    printf("\nNot enough memory for a table of %d stations\n", numOfNames);
+    exit(0);
+  }
+
+  //One full search per source. The first arrival node of each destination name taken off the heap is
+  //its target, same as the one a search for that destination alone stops at.
+  for(int from=0; from<numOfNames; from++) {
+    int *row = &time[(size_t) from * numOfNames], *rowTarget = &target[(size_t) from * numOfNames];
+    findShortestPath(g, search, from, -1);
+    for(int to=0; to<numOfNames; to++) {
+      row[to] = -1;
+      rowTarget[to] = -1;
+    }
+    for(int i=0; i<search->numSettled; i++) {
+      int node = search->settled[i], to = g->stations[STATION_OF_NODE(node)].name;
+      routeTime[node] = getRouteTime(search, routeTime, node);
+      if(!IS_ARRIVAL(node) || to == from || row[to] != -1 || IS_CLOSED(g, STATION_OF_NODE(node))) continue;
+      row[to] = routeTime[node];
+      rowTarget[to] = node;
+    }
+    row[from] = 0;
+    memcpy(&pred[(size_t) from * g->numOfNodes], search->pred, sizeof(int) * g->numOfNodes);
+  }
+
+  FILE *file = fopen(fileName, "wb");
+  if(file == NULL) {
+    printf("\n%s file could not be opened\n", fileName);
+    exit(0);
+  }
+  memcpy(header.magic, TABLE_MAGIC, 4);
+  header.version = TABLE_VERSION;
+  header.numOfNames = numOfNames;
+  header.numOfLines = g->numOfLines;
+  header.numOfStations = g->numOfStations;
+  header.numOfNodes = g->numOfNodes;
+  header.numOfEdges = g->numOfEdges;
+  header.graphHash = hashEdges(g);
+  header.stringPoolSize = stringPoolSize;
+  fwrite(&header, sizeof(header), 1, file);
+  fwrite(nameOffset, sizeof(int), numOfNames, file);
+  fwrite(lines, sizeof(TABLELINE), g->numOfLines, file);
+  fwrite(stations, sizeof(TABLESTATION), g->numOfStations, file);
+  fwrite(time, sizeof(int), (size_t) numOfNames * numOfNames, file);
+  fwrite(target, sizeof(int), (size_t) numOfNames * numOfNames, file);
+  fwrite(pred, sizeof(int), (size_t) numOfNames * g->numOfNodes, file);
+  for(int n=0; n<numOfNames; n++)
+    fwrite(g->stationNames->names[n], 1, strlen(g->stationNames->names[n]) + 1, file);
+  for(int i=0; i<g->numOfLines; i++)
+    fwrite(g->lineNames->names[i], 1, strlen(g->lineNames->names[i]) + 1, file);
+  if(fclose(file) != 0) {
+    printf("\n%s file could not be written\n", fileName);
+    exit(0);
+  }
+
+  free(nameOffset);
+  free(lines);
+  freeSearch(search);
+  free(stations);
+  free(time);
+  free(target);
+  free(pred);
+  free(routeTime);
+}
+
+
+// Unmap a table and free what was built for it
+void freeTable(TABLE* t) {
+  if(t->map != NULL) munmap(t->map, t->mapSize);
+  freeArena(t->arena);
+}
+
+
+/*
+ ******************************************************************
+ * Check the arrays of a table file before a query indexes with
+ * them. Every name is a string of the pool, every line, station
+ * and target points inside its array, the times of the stations
+ * are in range, and the shortest path tree of every source points
+ * inside the nodes and has no cycle, so that rebuilding a path
+ * from it always ends.
+ ******************************************************************
+ */
+bool checkTable(TABLE* t) {
+
+  TABLEHEADER *h = t->header;
+  if(h->numOfNodes != 2 * h->numOfStations) return false;
+  if(h->stringPoolSize > 0 && t->strings[h->stringPoolSize-1] != '\0') return false;
+  for(int n=0; n<h->numOfNames; n++)
+    if(t->names[n] < 0 || t->names[n] >= h->stringPoolSize) return false;
+  for(int i=0; i<h->numOfLines; i++) {
+    TABLELINE *line = &t->lines[i];
+    if(line->name < 0 || line->name >= h->stringPoolSize) return false;
+    if(line->start < 0 || line->start >= h->numOfNames || line->end < 0 || line->end >= h->numOfNames) return false;
+  }
+  for(int id=0; id<h->numOfStations; id++) {
+    TABLESTATION *station = &t->stations[id];
+    if(station->name < 0 || station->name >= h->numOfNames || station->line < 0 || station->line >= h->numOfLines) return false;
+    if(station->stationNumber < 0 || station->stopTime < 0 || station->stopTime > MAX_WEIGHT ||
+       station->rideClock < 0 || station->rideClock > INT_MAX/2) return false; //RIDE_TIME cannot overflow
+  }
+  for(size_t cell=0; cell < (size_t) h->numOfNames * h->numOfNames; cell++) {
+    if(t->target[cell] < -1 || t->target[cell] >= h->numOfNodes || t->time[cell] < -1) return false;
+  }
+
+  //Walk up from every node, marking the walk, until a node already known to end
+  char *state = (char*) malloc(h->numOfNodes); //0 not seen, 1 on the walk, 2 ends
+  bool good = true;
+  for(int from=0; good && from<h->numOfNames; from++) {
+    int *pred = &t->pred[(size_t) from * h->numOfNodes];
+    memset(state, 0, h->numOfNodes);
+    for(int n=0; good && n<h->numOfNodes; n++) {
+      int node = n;
+      while(node != -1 && state[node] == 0) {
+        if(pred[node] < -1 || pred[node] >= h->numOfNodes) {
+          good = false;
+          break;
+        }
+        state[node] = 1;
+        node = pred[node];
+      }
+      if(node != -1 && state[node] == 1) good = false; //Came back to the walk
+      for(node = n; node != -1 && state[node] == 1; node = pred[node]) state[node] = 2;
+    }
+  }
+  free(state);
+  return good;
+}
+
+
+/*
+ ******************************************************************
+ * Map a table file written by precomputeTable into memory. With
+ * the graph, which is loaded to update the table, check that the
+ * table was made for it. Returns NULL with what is wrong written
+ * to message.
+ ******************************************************************
+ */
+TABLE* loadTable(GRAPH* g, char* fileName, STATS* s, char* message, size_t size) {
+
+  STAT_START(loadStart);
+  struct stat info;
+  ARENA *arena = makeArena(s);
+  TABLE *t = (TABLE*) arenaAlloc(arena, sizeof(TABLE));
+  int fd = open(fileName, O_RDONLY);
+
+  t->arena = arena;
+  t->map = NULL;
+  if(fd == -1 || fstat(fd, &info) == -1) {
+    snprintf(message, size, "%s file could not be opened", fileName);
+    if(fd != -1) close(fd);
+    freeTable(t);
+    return NULL;
+  }
+  t->mapSize = info.st_size;
+  t->map = mmap(NULL, t->mapSize, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(t->map == MAP_FAILED) t->map = NULL;
+  if(t->mapSize < sizeof(TABLEHEADER) || t->map == NULL) {
+    snprintf(message, size, "%s is not a table file", fileName);
+    freeTable(t);
+    return NULL;
+  }
+
+  TABLEHEADER *h = t->header = (TABLEHEADER*) t->map;
+  if(memcmp(h->magic, TABLE_MAGIC, 4) != 0 || h->version != TABLE_VERSION) {
+    snprintf(message, size, "%s is not a version %d table file. Please run --precompute again.", fileName, TABLE_VERSION);
+    freeTable(t);
+    return NULL;
+  }
+  if(h->numOfNames < 0 || h->numOfLines < 0 || h->numOfStations < 0 || h->numOfNodes < 0 || h->stringPoolSize < 0) {
+    snprintf(message, size, "%s is truncated or corrupt", fileName);
+    freeTable(t);
+    return NULL;
+  }
+  size_t tableSize = sizeof(TABLEHEADER) + sizeof(int) * h->numOfNames + sizeof(TABLELINE) * h->numOfLines
+    + sizeof(TABLESTATION) * h->numOfStations + sizeof(int) * 2 * (size_t) h->numOfNames * h->numOfNames
+    + sizeof(int) * (size_t) h->numOfNames * h->numOfNodes + h->stringPoolSize;
+  if(t->mapSize != tableSize) {
+    snprintf(message, size, "%s is truncated or corrupt", fileName);
+    freeTable(t);
+    return NULL;
+  }
+  if(g != NULL && (h->numOfNames != g->numOfNames || h->numOfStations != g->numOfStations || h->numOfNodes != g->numOfNodes
+     || h->numOfEdges != g->numOfEdges || h->graphHash != hashEdges(g))) {
+    snprintf(message, size, "%s was made for another network. Please run --precompute again.", fileName);
+    freeTable(t);
+    return NULL;
+  }
+
+  t->names = (int*) (h + 1);
+  t->lines = (TABLELINE*) (t->names + h->numOfNames);
+  t->stations = (TABLESTATION*) (t->lines + h->numOfLines);
+  t->time = (int*) (t->stations + h->numOfStations);
+  t->target = t->time + (size_t) h->numOfNames * h->numOfNames;
+  t->pred = t->target + (size_t) h->numOfNames * h->numOfNames;
+  t->strings = (char*) (t->pred + (size_t) h->numOfNames * h->numOfNodes);
+  if(!checkTable(t)) {
+    snprintf(message, size, "%s is truncated or corrupt", fileName);
+    freeTable(t);
+    return NULL;
+  }
+
+  t->symbols = makeSymbols(arena);
+  for(int n=0; n<h->numOfNames; n++) {
+    if(internName(t->symbols, t->strings + t->names[n]) != n) {
+      snprintf(message, size, "%s has a station name twice", fileName);
+      freeTable(t);
+      return NULL;
+    }
+  }
+  STAT_STOP(s, PHASE_LOAD, loadStart);
+  return t;
+}
+
+
+// Add an edge to a list, or lower the weight of the edge to the same node
+void addEdge(EDGELIST* list, int node, int weight, int middle) {
+  for(int i=0; i<list->numOfEdges; i++) {
+    if(list->edges[i].node != node) continue;
+    if(weight < list->edges[i].weight) {
+      list->edges[i].weight = weight;
+      list->edges[i].middle = middle;
+    }
+    return;
+  }
+  if(list->numOfEdges == list->maxEdges) {
+    list->maxEdges = list->maxEdges == 0 ? 4 : 2*list->maxEdges;
+    list->edges = (HIERARCHYEDGE*) realloc(list->edges, sizeof(HIERARCHYEDGE) * list->maxEdges);
+  }
+  list->edges[list->numOfEdges].node = node;
+  list->edges[list->numOfEdges].weight = weight;
+  list->edges[list->numOfEdges++].middle = middle;
+}
+
+void removeEdge(EDGELIST* list, int node) {
+  for(int i=0; i<list->numOfEdges; i++) {
+    if(list->edges[i].node == node) {
+      list->edges[i] = list->edges[--list->numOfEdges];
+      return;
+    }
+  }
+}
+
+
+/*
+ ******************************************************************
+ * Dijkstra from source over the nodes not contracted yet, without
+ * going through skip, until maxDist or WITNESS_LIMIT nodes. The
+ * dist of a node is then the length of a path to it, not always
+ * the shortest one, so a shortcut is never wrongly left out.
+ ******************************************************************
+ */
+void findWitnesses(EDGELIST* out, SEARCH* s, int source, int skip, int maxDist) {
+  resetSearch(s);
+  heapDecrease(s, source, 0, -1);
+  while(s->heapSize > 0 && s->numSettled < WITNESS_LIMIT) {
+    int node = heapPop(s);
+    s->numSettled++;
+    if(s->dist[node] > maxDist) break;
+    for(int e=0; e<out[node].numOfEdges; e++) {
+      HIERARCHYEDGE *edge = &out[node].edges[e];
+      if(edge->node != skip && s->dist[node] + edge->weight < s->dist[edge->node])
+        heapDecrease(s, edge->node, s->dist[node] + edge->weight, node);
+    }
+  }
+}
+
+
+/*
+ ******************************************************************
+ * Contract a node: add a shortcut u -> x for every u -> node -> x
+ * that has no witness path as short without the node. With
+ * simulate the shortcuts are only counted. Returns their number.
+ ******************************************************************
+ */
+int contractNode(EDGELIST* out, EDGELIST* in, SEARCH* witness, int node, bool simulate) {
+
+  int shortcuts = 0;
+
+  for(int i=0; i<in[node].numOfEdges; i++) {
+    HIERARCHYEDGE into = in[node].edges[i];
+    int maxDist = 0;
+    for(int o=0; o<out[node].numOfEdges; o++)
+      if(out[node].edges[o].node != into.node && into.weight + out[node].edges[o].weight > maxDist)
+        maxDist = into.weight + out[node].edges[o].weight;
+    if(maxDist == 0) continue;
+
+    findWitnesses(out, witness, into.node, node, maxDist);
+    for(int o=0; o<out[node].numOfEdges; o++) {
+      HIERARCHYEDGE from = out[node].edges[o];
+      int weight = into.weight + from.weight;
+      if(from.node == into.node || witness->dist[from.node] <= weight) continue;
+      shortcuts++;
+      if(!simulate) {
+        addEdge(&out[into.node], from.node, weight, node);
+        addEdge(&in[from.node], into.node, weight, node);
+      }
+    }
+  }
+  return shortcuts;
+}
+
+// Nodes that add the fewest edges and have the fewest contracted neighbours go first
+int getPriority(EDGELIST* out, EDGELIST* in, SEARCH* witness, int deleted[], int node) {
+  return contractNode(out, in, witness, node, true) - out[node].numOfEdges - in[node].numOfEdges + deleted[node];
+}
+
+
+/*
+ ******************************************************************
+ * Build the contraction hierarchy of the graph and write it to a
+ * file. The nodes are contracted in priority order, updated lazily
+ * when they come off the heap. When a node is contracted its edges
+ * are the edges to higher ranked nodes, so they are kept as they
+ * are and the node is taken out of the lists of its neighbours.
+ ******************************************************************
+ */
+void contractGraph(GRAPH* g, char* fileName) {
+
+  int numOfNodes = g->numOfNodes, numOfContracted = 0, numOfForward = 0, numOfBackward = 0;
+  EDGELIST *out = (EDGELIST*) calloc(numOfNodes, sizeof(EDGELIST)), *in = (EDGELIST*) calloc(numOfNodes, sizeof(EDGELIST));
+  int *rank = (int*) malloc(sizeof(int) * numOfNodes), *deleted = (int*) calloc(numOfNodes, sizeof(int));
+  SEARCH *witness = makeSearch(numOfNodes), *order = makeSearch(numOfNodes);
+  HIERARCHYHEADER header;
+
+  for(int n=0; n<numOfNodes; n++) {
+    for(int e=g->edgeStart[n]; e<g->edgeStart[n+1]; e++) {
+      if(g->edgeWeight[e] == CLOSED) continue;
+      addEdge(&out[n], g->edgeTarget[e], EDGE_COST(g, n, e), -1);
+      addEdge(&in[g->edgeTarget[e]], n, EDGE_COST(g, n, e), -1);
+    }
+  }
+  for(int n=0; n<numOfNodes; n++)
+    heapDecrease(order, n, getPriority(out, in, witness, deleted, n), -1);
+
+  while(order->heapSize > 0) {
+    int node = heapPop(order);
+    int priority = getPriority(out, in, witness, deleted, node);
+    if(order->heapSize > 0 && priority > order->dist[order->heap[0]]) {
+      heapDecrease(order, node, priority, -1);
+      continue;
+    }
+    contractNode(out, in, witness, node, false);
+    rank[node] = numOfContracted++;
+    for(int e=0; e<out[node].numOfEdges; e++) {
+      removeEdge(&in[out[node].edges[e].node], node);
+      deleted[out[node].edges[e].node]++;
+    }
+    for(int e=0; e<in[node].numOfEdges; e++) {
+      removeEdge(&out[in[node].edges[e].node], node);
+      deleted[in[node].edges[e].node]++;
+    }
+    numOfForward += out[node].numOfEdges;
+    numOfBackward += in[node].numOfEdges;
+  }
+
+  FILE *file = fopen(fileName, "wb");
+  if(file == NULL) {
+    printf("\n%s file could not be opened\n", fileName);
+    exit(0);
+  }
+  memcpy(header.magic, HIERARCHY_MAGIC, 4);
+  header.version = HIERARCHY_VERSION;
+  header.numOfNodes = numOfNodes;
+  header.numOfEdges = g->numOfEdges;
+  header.graphHash = hashEdges(g);
+  header.numOfForward = numOfForward;
+  header.numOfBackward = numOfBackward;
+  fwrite(&header, sizeof(header), 1, file);
+  fwrite(rank, sizeof(int), numOfNodes, file);
+  for(int pass=0; pass<2; pass++) {
+    EDGELIST *lists = pass == 0 ? out : in;
+    int start = 0;
+    for(int n=0; n<numOfNodes; n++) {
+      fwrite(&start, sizeof(int), 1, file);
+      start += lists[n].numOfEdges;
+    }
+    fwrite(&start, sizeof(int), 1, file);
+    for(int n=0; n<numOfNodes; n++)
+      fwrite(lists[n].edges, sizeof(HIERARCHYEDGE), lists[n].numOfEdges, file);
+  }
+  if(fclose(file) != 0) {
+    printf("\n%s file could not be written\n", fileName);
+    exit(0);
+  }
+  printf("\n%d nodes, %d edges and %d shortcuts\n", numOfNodes, g->numOfEdges, numOfForward + numOfBackward - g->numOfEdges);
+
+  for(int n=0; n<numOfNodes; n++) {
+    free(out[n].edges);
+    free(in[n].edges);
+  }
+  free(out);
+  free(in);
+  free(rank);
+  free(deleted);
+  freeSearch(witness);
+  freeSearch(order);
+}
+
+
+void freeHierarchy(HIERARCHY* h) {
+  if(h->map != NULL) munmap(h->map, h->mapSize);
+  free(h->changed);
+  free(h);
+}
+
+// Copy a hierarchy for an update to a published network. Only the changed flags are copied, the file stays mapped by h.
+HIERARCHY* copyHierarchy(HIERARCHY* h, int numOfStations) {
+  HIERARCHY *temp = NEW(HIERARCHY);
+  *temp = *h;
+  temp->map = NULL;
+  temp->mapSize = 0;
+  if(h->changed != NULL) temp->changed = (unsigned char*) memcpy(malloc(numOfStations), h->changed, numOfStations);
+  return temp;
+}
+
+
+HIERARCHYEDGE* findHierarchyEdge(HIERARCHYEDGE edges[], int first, int last, int node) {
+  for(int e=first; e<last; e++)
+    if(edges[e].node == node) return &edges[e];
+  return NULL;
+}
+
+// The lowest cost of an open graph edge from -> to, as contractGraph keeps it, -1 if there is none
+int findGraphEdge(GRAPH* g, int from, int to) {
+  int weight = -1;
+  for(int e=g->edgeStart[from]; e<g->edgeStart[from+1]; e++)
+    if(g->edgeTarget[e] == to && g->edgeWeight[e] != CLOSED && (weight == -1 || EDGE_COST(g, from, e) < weight))
+      weight = EDGE_COST(g, from, e);
+  return weight;
+}
+
+/*
+ ******************************************************************
+ * Check the edges of a hierarchy file against the graph, so that
+ * a query never follows an edge that is not there. Every edge goes
+ * up the ranks, an edge is an edge of the graph with its weight,
+ * and a shortcut is made of the two edges through its middle node,
+ * which is ranked below both ends, so unpacking it always ends.
+ ******************************************************************
+ */
+bool checkHierarchyEdges(GRAPH* g, HIERARCHY* h) {
+
+  int numOfNodes = h->header->numOfNodes;
+
+  for(int pass=0; pass<2; pass++) {
+    int *start = pass == 0 ? h->forwardStart : h->backwardStart;
+    int numOfEdges = pass == 0 ? h->header->numOfForward : h->header->numOfBackward;
+    if(start[0] != 0 || start[numOfNodes] != numOfEdges) return false;
+    for(int n=0; n<numOfNodes; n++)
+      if(start[n+1] < start[n]) return false;
+  }
+  for(int pass=0; pass<2; pass++) {
+    int *start = pass == 0 ? h->forwardStart : h->backwardStart;
+    HIERARCHYEDGE *edges = pass == 0 ? h->forward : h->backward;
+    for(int n=0; n<numOfNodes; n++) {
+      for(int e=start[n]; e<start[n+1]; e++) {
+        //The edge from -> to, stored at from going forward and at to going backward
+        int other = edges[e].node, middle = edges[e].middle;
+        int from = pass == 0 ? n : other, to = pass == 0 ? other : n;
+        if(other < 0 || other >= numOfNodes || h->rank[other] <= h->rank[n]) return false;
+        if(middle == -1) {
+          if(findGraphEdge(g, from, to) != edges[e].weight) return false;
+          continue;
+        }
+        if(middle < 0 || middle >= numOfNodes || h->rank[middle] >= h->rank[n] || h->rank[middle] >= h->rank[other]) return false;
+        HIERARCHYEDGE *down = findHierarchyEdge(h->backward, h->backwardStart[middle], h->backwardStart[middle+1], from);
+        HIERARCHYEDGE *up = findHierarchyEdge(h->forward, h->forwardStart[middle], h->forwardStart[middle+1], to);
+        if(down == NULL || up == NULL || (long long) down->weight + up->weight != edges[e].weight) return false;
+      }
+    }
+  }
+  return true;
+}
+
+
+/*
+ ******************************************************************
+ * Map a hierarchy file written by contractGraph into memory and
+ * check that it was made for the graph. Returns NULL with what
+ * is wrong written to message.
+ ******************************************************************
+ */
+HIERARCHY* loadHierarchy(GRAPH* g, char* fileName, STATS* s, char* message, size_t size) {
+
+  STAT_START(loadStart);
+  struct stat info;
+  HIERARCHY *h = NEW(HIERARCHY);
+  int fd = open(fileName, O_RDONLY);
+
+  h->map = NULL;
+  h->changed = NULL;
+  if(fd == -1 || fstat(fd, &info) == -1) {
+    snprintf(message, size, "%s file could not be opened", fileName);
+    if(fd != -1) close(fd);
+    freeHierarchy(h);
+    return NULL;
+  }
+  h->mapSize = info.st_size;
+  h->map = mmap(NULL, h->mapSize, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(h->map == MAP_FAILED) h->map = NULL;
+  if(h->mapSize < sizeof(HIERARCHYHEADER) || h->map == NULL) {
+    snprintf(message, size, "%s is not a hierarchy file", fileName);
+    freeHierarchy(h);
+    return NULL;
+  }
+
+  HIERARCHYHEADER *header = h->header = (HIERARCHYHEADER*) h->map;
+  if(memcmp(header->magic, HIERARCHY_MAGIC, 4) != 0 || header->version != HIERARCHY_VERSION) {
+    snprintf(message, size, "%s is not a version %d hierarchy file. Please run --contract again.", fileName, HIERARCHY_VERSION);
+    freeHierarchy(h);
+    return NULL;
+  }
+  size_t hierarchySize = sizeof(HIERARCHYHEADER) + sizeof(int) * (3 * (size_t) header->numOfNodes + 2)
+    + sizeof(HIERARCHYEDGE) * ((size_t) header->numOfForward + header->numOfBackward);
+  if(h->mapSize != hierarchySize) {
+    snprintf(message, size, "%s is truncated or corrupt", fileName);
+    freeHierarchy(h);
+    return NULL;
+  }
+  if(header->numOfNodes != g->numOfNodes || header->numOfEdges != g->numOfEdges || header->graphHash != hashEdges(g)) {
+    snprintf(message, size, "%s was made for another network. Please run --contract again.", fileName);
+    freeHierarchy(h);
+    return NULL;
+  }
+
+  h->rank = (int*) (header + 1);
+  h->forwardStart = h->rank + header->numOfNodes;
+  h->forward = (HIERARCHYEDGE*) (h->forwardStart + header->numOfNodes + 1);
+  h->backwardStart = (int*) (h->forward + header->numOfForward);
+  h->backward = (HIERARCHYEDGE*) (h->backwardStart + header->numOfNodes + 1);
+  if(!checkHierarchyEdges(g, h)) {
+    snprintf(message, size, "%s is truncated or corrupt", fileName);
+    freeHierarchy(h);
+    return NULL;
+  }
+  STAT_STOP(s, PHASE_LOAD, loadStart);
+  return h;
+}
+
+
+/*
+ ******************************************************************
+ * Bidirectional search of the hierarchy. The forward half goes up
+ * from the departure nodes of the source name, the backward half
+ * goes up from the arrival nodes of the destination name, both
+ * only along edges to higher ranked nodes. A half stops when its
+ * nearest node is not nearer than the best meeting found. Returns
+ * the meeting node of the fastest path, -1 if there is no path.
+ ******************************************************************
+ */
+int findHierarchyPath(GRAPH* g, HIERARCHY* h, SEARCH* s, int source, int dest) {
+
+  SEARCH *forward = s, *backward = s->backward;
+  int best = INT_MAX, meet = -1;
+
+  resetSearch(forward);
+  resetSearch(backward);
+  for(int i=g->nameStart[source]; i<g->nameStart[source+1]; i++)
+    if(!IS_CLOSED(g, g->nameStations[i])) heapDecrease(forward, DEPARTURE(g->nameStations[i]), 0, -1);
+  for(int i=g->nameStart[dest]; i<g->nameStart[dest+1]; i++)
+    if(!IS_CLOSED(g, g->nameStations[i])) heapDecrease(backward, ARRIVAL(g->nameStations[i]), 0, -1);
+
+  while(true) {
+    bool goForward = forward->heapSize > 0 && forward->dist[forward->heap[0]] < best;
+    bool goBackward = backward->heapSize > 0 && backward->dist[backward->heap[0]] < best;
+    if(!goForward && !goBackward) break;
+    if(goForward && goBackward) goForward = forward->dist[forward->heap[0]] <= backward->dist[backward->heap[0]];
+
+    SEARCH *current = goForward ? forward : backward, *other = goForward ? backward : forward;
+    int *start = goForward ? h->forwardStart : h->backwardStart, *downStart = goForward ? h->backwardStart : h->forwardStart;
+    HIERARCHYEDGE *edges = goForward ? h->forward : h->backward, *down = goForward ? h->backward : h->forward;
+    int node = heapPop(current);
+    current->settled[current->numSettled++] = node;
+    if(other->dist[node] != INT_MAX && current->dist[node] + other->dist[node] < best) {
+      best = current->dist[node] + other->dist[node];
+      meet = node;
+    }
+
+    //Stall on demand: a higher ranked node reached already gives a shorter way here, so this is not on a fastest path
+    bool stalled = false;
+    for(int e=downStart[node]; e<downStart[node+1] && !stalled; e++)
+      stalled = current->dist[down[e].node] != INT_MAX && current->dist[down[e].node] + down[e].weight < current->dist[node];
+    if(stalled) continue;
+
+    STAT_ADD(&s->stats, COUNT_EDGES_SCANNED, start[node+1] - start[node]);
+    for(int e=start[node]; e<start[node+1]; e++) {
+      int dist = current->dist[node] + edges[e].weight;
+      if(dist < current->dist[edges[e].node])
+        heapDecrease(current, edges[e].node, dist, node);
+    }
+  }
+  STAT_ADD(&s->stats, COUNT_NODES_SETTLED, forward->numSettled + backward->numSettled);
+  return meet;
+}
+
+// Append the graph nodes after from on the hierarchy edge from -> to, replacing shortcuts by the edges they were made of
+void unpackEdge(HIERARCHY* h, int from, int to, int middle, int path[], int* pathLength) {
+  if(middle == -1) {
+    path[(*pathLength)++] = to;
+    return;
+  }
+  HIERARCHYEDGE *down = findHierarchyEdge(h->backward, h->backwardStart[middle], h->backwardStart[middle+1], from);
+  HIERARCHYEDGE *up = findHierarchyEdge(h->forward, h->forwardStart[middle], h->forwardStart[middle+1], to);
+  unpackEdge(h, from, middle, down->middle, path, pathLength);
+  unpackEdge(h, middle, to, up->middle, path, pathLength);
+}
+
+
+/*
+ ******************************************************************
+ * Store the graph path through the meeting node of a hierarchy
+ * search, from the source to the destination. Returns the path
+ * length.
+ ******************************************************************
+ */
+int getHierarchyPath(HIERARCHY* h, SEARCH* s, int meet, int path[]) {
+
+  int *up = s->backward->path, numUp = 0, pathLength = 0;
+
+  //Forward half, collected from the meeting node down to the source
+  for(int node = meet; node != -1; node = s->pred[node])
+    up[numUp++] = node;
+  path[pathLength++] = up[numUp-1];
+  for(int i=numUp-1; i>0; i--) {
+    HIERARCHYEDGE *edge = findHierarchyEdge(h->forward, h->forwardStart[up[i]], h->forwardStart[up[i]+1], up[i-1]);
+    unpackEdge(h, up[i], up[i-1], edge->middle, path, &pathLength);
+  }
+
+  //Backward half, from the meeting node to the destination
+  for(int node = meet; s->backward->pred[node] != -1; node = s->backward->pred[node]) {
+    int next = s->backward->pred[node];
+    HIERARCHYEDGE *edge = findHierarchyEdge(h->backward, h->backwardStart[next], h->backwardStart[next+1], node);
+    unpackEdge(h, node, next, edge->middle, path, &pathLength);
+  }
+  return pathLength;
+}
+
+
+/*
+ ******************************************************
+ * Find the path in the graph and write to the file.
+ ******************************************************
+ */
+int answerQueryFromGraph(GRAPH* g, SEARCH* search, int source, int dest) {
+
+  STAT_START(routeStart);
+  int target = findShortestPath(g, search, source, dest);
+  STAT_STOP(&search->stats, PHASE_ROUTE, routeStart);
+  if(target == -1) return QUERY_NO_PATH;
+
+  STAT_START(formatStart);
+  int pathLength = search->pathLength = getPath(search->pred, target, search->path);
+  int numOfLegs = getLegs(search->path, pathLength, search->legs);
+  describeLegs(g, search->legs, numOfLegs);
+  STAT_STOP(&search->stats, PHASE_FORMAT, formatStart);
+
+  STAT_START(outputStart);
+  int written = writeItinerary(search, search->legs, numOfLegs, ROUTE_TIME(search->dist[target], numOfLegs), false, 1, 0);
+  STAT_STOP(&search->stats, PHASE_OUTPUT, outputStart);
+  STAT_ADD(&search->stats, COUNT_BYTES_WRITTEN, written);
+  return QUERY_OK;
+}
+
+
+/*
+ ******************************************************************
+ * Answer a query from the table: look up the time and rebuild the
+ * legs from the stored shortest path tree of the source. A path
+ * through a station updates slowed down, marked in changed, is
+ * searched in the graph g instead, see answerQueryFromHierarchy.
+ ******************************************************************
+ */
+int answerQueryFromTable(TABLE* t, GRAPH* g, unsigned char* changed, SEARCH* search, int from, int to) {
+
+  size_t cell = (size_t) from * t->header->numOfNames + to;
+
+  if(t->target[cell] == -1) return QUERY_NO_PATH; //Updates only slowed the network down, there is still none
+
+  STAT_START(routeStart);
+  int pathLength = search->pathLength = getPath(&t->pred[(size_t) from * t->header->numOfNodes], t->target[cell], search->path);
+  STAT_STOP(&search->stats, PHASE_ROUTE, routeStart);
+  for(int i=0; changed != NULL && i<pathLength; i++)
+    if(changed[STATION_OF_NODE(search->path[i])]) return answerQueryFromGraph(g, search, from, to);
+
+  STAT_START(formatStart);
+  int numOfLegs = getLegs(search->path, pathLength, search->legs);
+
+  for(int i=0; i<numOfLegs; i++) {
+    TABLESTATION *a = &t->stations[search->legs[i].from], *b = &t->stations[search->legs[i].to];
+    TABLELINE *current = &t->lines[a->line];
+    search->legs[i].lineName = t->strings + current->name;
+    search->legs[i].fromStation = t->strings + t->names[a->name];
+    search->legs[i].toStation = t->strings + t->names[b->name];
+    search->legs[i].towards = t->strings + t->names[a->stationNumber > b->stationNumber ? current->start : current->end];
+    search->legs[i].numOfStations = abs(b->stationNumber - a->stationNumber);
+    search->legs[i].rideTime = RIDE_TIME(a, b);
+  }
+  STAT_STOP(&search->stats, PHASE_FORMAT, formatStart);
+
+  STAT_START(outputStart);
+  int written = writeItinerary(search, search->legs, numOfLegs, t->time[cell], false, 1, 0);
+  STAT_STOP(&search->stats, PHASE_OUTPUT, outputStart);
+  STAT_ADD(&search->stats, COUNT_BYTES_WRITTEN, written);
+  return QUERY_OK;
+}
+
+
+/*
+ ******************************************************
+ * Find up to numOfAlternatives routes in the graph and
+ * write them to the file, fastest first, each with
+ * its number of transfers.
+ ******************************************************
+ */
+int answerQueryWithAlternatives(GRAPH* g, SEARCH* search, int source, int dest) {
+
+  STAT_START(routeStart);
+  if(search->alternatives == NULL) search->alternatives = makeAlternatives(g->numOfNames, g->numOfStations);
+  ALTERNATIVES *a = search->alternatives;
+  int found = findAlternatives(g, search, a, source, dest, numOfAlternatives);
+  STAT_STOP(&search->stats, PHASE_ROUTE, routeStart);
+  if(found == 0) return QUERY_NO_PATH;
+
+  //The stations of all the routes, for the cache
+  search->pathLength = 0;
+  a->stamp++;
+  for(int r=0; r<found; r++) {
+    ALTPATH *route = &a->paths[a->accepted[r]];
+    for(int i=0; i<route->length; i++) {
+      int node = a->nodes[route->start + i];
+      if(a->stationStamp[STATION_OF_NODE(node)] == a->stamp) continue;
+      a->stationStamp[STATION_OF_NODE(node)] = a->stamp;
+      search->path[search->pathLength++] = node;
+    }
+  }
+
+  int written = 0;
+  for(int r=0; r<found; r++) {
+    ALTPATH *route = &a->paths[a->accepted[r]];
+    STAT_START(formatStart);
+    int numOfLegs = getLegs(&a->nodes[route->start], route->length, search->legs);
+    describeLegs(g, search->legs, numOfLegs);
+    STAT_STOP(&search->stats, PHASE_FORMAT, formatStart);
+
+    STAT_START(outputStart);
+    written += writeItinerary(search, search->legs, numOfLegs, ROUTE_TIME(PATH_TIME(a, a->accepted[r]), numOfLegs), false, r+1, found);
+    STAT_STOP(&search->stats, PHASE_OUTPUT, outputStart);
+  }
+  STAT_ADD(&search->stats, COUNT_BYTES_WRITTEN, written);
+  return QUERY_OK;
+}
+
+
+/*
+ ******************************************************
+ * Find the fastest route for every number of transfers
+ * that saves time over fewer transfers and write them
+ * to the file, fastest first.
+ ******************************************************
+ */
+int answerQueryWithFewerTransfers(GRAPH* g, SEARCH* search, int source, int dest) {
+
+  int targets[PARETO_LABELS];
+  STAT_START(routeStart);
+  if(search->labels == NULL) {
+    search->labels = makeSearch(g->numOfNodes * PARETO_LABELS);
+    free(search->labels->legs); //The legs are made in search, the biggest array of labels is not needed
+    search->labels->legs = NULL;
+  }
+  SEARCH *labels = search->labels;
+  int found = findParetoPaths(g, labels, source, dest, targets);
+  STAT_STOP(&search->stats, PHASE_ROUTE, routeStart);
+  if(found == 0) return QUERY_NO_PATH;
+
+  int written = 0, numOfStations = 0;
+  for(int r=0; r<found; r++) {
+    STAT_START(formatStart);
+    int pathLength = getPath(labels->pred, targets[r], search->path);
+    for(int i=0; i<pathLength; i++) {
+      search->path[i] /= PARETO_LABELS;
+      labels->path[numOfStations++] = STATION_OF_NODE(search->path[i]);
+    }
+    int numOfLegs = getLegs(search->path, pathLength, search->legs);
+    describeLegs(g, search->legs, numOfLegs);
+    STAT_STOP(&search->stats, PHASE_FORMAT, formatStart);
+
+    STAT_START(outputStart);
+    written += writeItinerary(search, search->legs, numOfLegs, labels->dist[targets[r]], false, r+1, found);
+    STAT_STOP(&search->stats, PHASE_OUTPUT, outputStart);
+  }
+  STAT_ADD(&search->stats, COUNT_BYTES_WRITTEN, written);
+
+  //The stations of all the routes, once each, for the cache
+  qsort(labels->path, numOfStations, sizeof(int), compareInt);
+  search->pathLength = 0;
+  for(int i=0; i<numOfStations; i++)
+    if(i == 0 || labels->path[i] != labels->path[i-1]) search->path[search->pathLength++] = ARRIVAL(labels->path[i]);
+  return QUERY_OK;
+}
+
+
+/*
+ ******************************************************
+ * Find the path with the contraction hierarchy and
+ * write to the file.
+ ******************************************************
+ */
+int answerQueryFromHierarchy(GRAPH* g, HIERARCHY* h, SEARCH* search, int source, int dest) {
+
+  STAT_START(routeStart);
+  if(search->backward == NULL) search->backward = makeSearch(g->numOfNodes);
+  int meet = findHierarchyPath(g, h, search, source, dest);
+  STAT_STOP(&search->stats, PHASE_ROUTE, routeStart);
+  if(meet == -1) return QUERY_NO_PATH;
+
+  STAT_START(formatStart);
+  int pathLength = search->pathLength = getHierarchyPath(h, search, meet, search->path);
+  //Updates only slowed the network down since the hierarchy was made. A path through none of the changed stations
+  //has the same time as then and every other path is as slow or slower, so it is still the fastest. Others may not be.
+  for(int i=0; h->changed != NULL && i<pathLength; i++) {
+    if(h->changed[STATION_OF_NODE(search->path[i])]) {
+      STAT_STOP(&search->stats, PHASE_FORMAT, formatStart);
+      return answerQueryFromGraph(g, search, source, dest);
+    }
+  }
+  int numOfLegs = getLegs(search->path, pathLength, search->legs);
+  describeLegs(g, search->legs, numOfLegs);
+  STAT_STOP(&search->stats, PHASE_FORMAT, formatStart);
+
+  STAT_START(outputStart);
+  int written = writeItinerary(search, search->legs, numOfLegs, ROUTE_TIME(search->dist[meet] + search->backward->dist[meet], numOfLegs), false, 1, 0);
+  STAT_STOP(&search->stats, PHASE_OUTPUT, outputStart);
+  STAT_ADD(&search->stats, COUNT_BYTES_WRITTEN, written);
+  return QUERY_OK;
+}
+
+
+/*
+ ******************************************************
+ * Find the earliest arrival in the timetable when
+ * leaving at the departure time and write to the file.
+ ******************************************************
+ */
+int answerQueryFromSchedule(GRAPH* g, SCHEDULE* sc, SEARCH* search, int source, int dest, int departure) {
+
+  int rides = 0;
+
+  STAT_START(routeStart);
+  int target = findEarliestArrival(g, sc, search, source, dest, departure, &rides);
+  STAT_STOP(&search->stats, PHASE_ROUTE, routeStart);
+  if(target == -1) return QUERY_NO_PATH;
+
+  STAT_START(formatStart);
+  int numOfLegs = getTimedLegs(sc, search->raptor, target, rides, search->legs);
+  describeLegs(g, search->legs, numOfLegs);
+  STAT_STOP(&search->stats, PHASE_FORMAT, formatStart);
+
+  STAT_START(outputStart);
+  int written = writeItinerary(search, search->legs, numOfLegs, search->legs[numOfLegs-1].arrival - departure, true, 1, 0);
+  STAT_STOP(&search->stats, PHASE_OUTPUT, outputStart);
+  STAT_ADD(&search->stats, COUNT_BYTES_WRITTEN, written);
+  return QUERY_OK;
+}
+
+
+/*
+ ******************************************************
+ * Make a cache that holds up to maxEntries itineraries
+ * over all its shards.
+ ******************************************************
+ */
+CACHE* makeCache(int maxEntries) {
+  CACHE *temp = NEW(CACHE);
+  int perShard = (maxEntries + CACHE_SHARDS - 1) / CACHE_SHARDS;
+  for(int i=0; i<CACHE_SHARDS; i++) {
+    CACHESHARD *shard = &temp->shards[i];
+    pthread_mutex_init(&shard->lock, NULL);
+    for(shard->numOfBuckets = 16; shard->numOfBuckets < perShard; shard->numOfBuckets *= 2);
+    shard->buckets = (CACHEENTRY**) calloc(shard->numOfBuckets, sizeof(CACHEENTRY*));
+    shard->numOfEntries = 0;
+    shard->maxEntries = perShard;
+    shard->newest = shard->oldest = NULL;
+  }
+  return temp;
+}
+
+void freeCache(CACHE* c) {
+  for(int i=0; i<CACHE_SHARDS; i++) {
+    CACHESHARD *shard = &c->shards[i];
+    for(CACHEENTRY *entry = shard->newest, *older; entry != NULL; entry = older) {
+      older = entry->older;
+      free(entry->text);
+      free(entry->stations);
+      free(entry);
+    }
+    free(shard->buckets);
+    pthread_mutex_destroy(&shard->lock);
+  }
+  free(c);
+}
+
+unsigned int hashCacheKey(int source, int dest, int departure) {
+  unsigned int hash = 2166136261u;
+  hash = (hash ^ (unsigned int) source) * 16777619u;
+  hash = (hash ^ (unsigned int) dest) * 16777619u;
+  hash = (hash ^ (unsigned int) departure) * 16777619u;
+  return hash ^ (hash >> 15);
+}
+
+// Take an entry out of the LRU list of its shard
+void unlinkEntry(CACHESHARD* shard, CACHEENTRY* entry) {
+  if(entry->newer != NULL) entry->newer->older = entry->older;
+  else shard->newest = entry->older;
+  if(entry->older != NULL) entry->older->newer = entry->newer;
+  else shard->oldest = entry->newer;
+}
+
+// Put an entry at the front of the LRU list of its shard
+void linkNewest(CACHESHARD* shard, CACHEENTRY* entry) {
+  entry->newer = NULL;
+  entry->older = shard->newest;
+  if(shard->newest != NULL) shard->newest->newer = entry;
+  else shard->oldest = entry;
+  shard->newest = entry;
+}
+
+// Take an entry out of its shard and free what it holds, but not the entry itself
+void dropEntry(CACHESHARD* shard, CACHEENTRY* entry) {
+  unsigned int hash = hashCacheKey(entry->source, entry->dest, entry->departure);
+  CACHEENTRY **link = &shard->buckets[(hash / CACHE_SHARDS) & (shard->numOfBuckets - 1)];
+  while(*link != entry) link = &(*link)->chain;
+  *link = entry->chain;
+  unlinkEntry(shard, entry);
+  free(entry->text);
+  free(entry->stations);
+}
+
+
+// Copy a cache for an update to a published network, with its entries in the same buckets and the same order
+CACHE* copyCache(CACHE* c) {
+  CACHE *temp = makeCache(c->shards[0].maxEntries * CACHE_SHARDS);
+  for(int i=0; i<CACHE_SHARDS; i++) {
+    CACHESHARD *from = &c->shards[i], *to = &temp->shards[i];
+    pthread_mutex_lock(&from->lock);
+    for(CACHEENTRY *entry = from->oldest; entry != NULL; entry = entry->newer) {
+      CACHEENTRY *copy = NEW(CACHEENTRY);
+      *copy = *entry;
+      copy->text = (char*) memcpy(malloc(entry->length + 1), entry->text, entry->length);
+      copy->stations = (int*) memcpy(malloc(sizeof(int) * (entry->numOfStations + 1)), entry->stations, sizeof(int) * entry->numOfStations);
+      unsigned int hash = hashCacheKey(entry->source, entry->dest, entry->departure);
+      CACHEENTRY **bucket = &to->buckets[(hash / CACHE_SHARDS) & (to->numOfBuckets - 1)];
+      copy->chain = *bucket;
+      *bucket = copy;
+      linkNewest(to, copy);
+      to->numOfEntries++;
+    }
+    pthread_mutex_unlock(&from->lock);
+  }
+  return temp;
+}
+
+
+/*
+ ******************************************************
+ * Look for the answer of a query in the cache. On a
+ * hit the itinerary is written to the output of the
+ * search, the entry becomes the newest of its shard
+ * and the stored result is returned. Returns -1 on a
+ * miss.
+ ******************************************************
+ */
+int findCachedAnswer(CACHE* c, SEARCH* search, int source, int dest, int departure) {
+
+  unsigned int hash = hashCacheKey(source, dest, departure);
+  CACHESHARD *shard = &c->shards[hash % CACHE_SHARDS];
+  int result = -1;
+
+  pthread_mutex_lock(&shard->lock);
+  CACHEENTRY *entry = shard->buckets[(hash / CACHE_SHARDS) & (shard->numOfBuckets - 1)];
+  while(entry != NULL && (entry->source != source || entry->dest != dest || entry->departure != departure))
+    entry = entry->chain;
+  if(entry != NULL) {
+    unlinkEntry(shard, entry);
+    linkNewest(shard, entry);
+    fwrite(entry->text, 1, entry->length, search->output);
+    STAT_ADD(&search->stats, COUNT_BYTES_WRITTEN, entry->length);
+    result = entry->result;
+  }
+  pthread_mutex_unlock(&shard->lock);
+  STAT_ADD(&search->stats, result == -1 ? COUNT_CACHE_MISSES : COUNT_CACHE_HITS, 1);
+  return result;
+}
+
+
+/*
+ ******************************************************
+ * Store the answer of a query in the cache, dropping
+ * the least recently used entry of the shard when it
+ * is full. An entry another thread stored meanwhile is
+ * kept as it is. The stations of the path are kept
+ * with the itinerary. Returns true if an entry was
+ * dropped.
+ ******************************************************
+ */
+bool storeAnswer(CACHE* c, int source, int dest, int departure, int result, char* text, size_t length, int path[], int pathLength) {
+
+  unsigned int hash = hashCacheKey(source, dest, departure);
+  CACHESHARD *shard = &c->shards[hash % CACHE_SHARDS];
+  CACHEENTRY **bucket = &shard->buckets[(hash / CACHE_SHARDS) & (shard->numOfBuckets - 1)];
+
+  pthread_mutex_lock(&shard->lock);
+  for(CACHEENTRY *entry = *bucket; entry != NULL; entry = entry->chain) {
+    if(entry->source == source && entry->dest == dest && entry->departure == departure) {
+      pthread_mutex_unlock(&shard->lock);
+      return false;
+    }
+  }
+
+  CACHEENTRY *entry;
+  bool evicted = shard->numOfEntries == shard->maxEntries;
+  if(evicted) { //Reuse the oldest entry
+    entry = shard->oldest;
+    dropEntry(shard, entry);
+  }
+  else {
+    entry = NEW(CACHEENTRY);
+    shard->numOfEntries++;
+  }
+  entry->source = source;
+  entry->dest = dest;
+  entry->departure = departure;
+  entry->result = result;
+  entry->text = (char*) malloc(length + 1);
+  memcpy(entry->text, text, length);
+  entry->length = length;
+  entry->stations = (int*) malloc(sizeof(int) * (pathLength + 1));
+  entry->numOfStations = 0;
+  for(int i=0; i<pathLength; i++) //The two nodes of a station follow each other on a path
+    if(i == 0 || STATION_OF_NODE(path[i]) != STATION_OF_NODE(path[i-1]))
+      entry->stations[entry->numOfStations++] = STATION_OF_NODE(path[i]);
+  entry->chain = *bucket;
+  *bucket = entry;
+  linkNewest(shard, entry);
+  pthread_mutex_unlock(&shard->lock);
+  return evicted;
+}
+
+
+/*
+ ******************************************************
+ * Drop the cached answers that go through one of the
+ * stations, or all of them. Returns how many were
+ * dropped.
+ ******************************************************
+ */
+int invalidateCache(CACHE* c, bool all, int stations[], int numOfStations) {
+
+  int dropped = 0;
+
+  for(int i=0; i<CACHE_SHARDS; i++) {
+    CACHESHARD *shard = &c->shards[i];
+    pthread_mutex_lock(&shard->lock);
+    for(CACHEENTRY *entry = shard->newest, *older; entry != NULL; entry = older) {
+      older = entry->older;
+      bool affected = all;
+      for(int s=0; s<entry->numOfStations && !affected; s++)
+        for(int a=0; a<numOfStations && !affected; a++)
+          affected = entry->stations[s] == stations[a];
+      if(!affected) continue;
+
+      dropEntry(shard, entry);
+      free(entry);
+      shard->numOfEntries--;
+      dropped++;
+    }
+    pthread_mutex_unlock(&shard->lock);
+  }
+  return dropped;
+}
+
+
+// Station names of a network, the ids of the queries
+SYMBOLS* getStationNames(NETWORK* n) {
+  return n->table != NULL ? n->table->symbols : n->graph->stationNames;
+}
+
+
+// Free what a network owns. A copy owns its graph, hierarchy, cache and changed flags, the rest is its base's.
+void freeLoadedNetwork(NETWORK* n) {
+  free(n->tableChanged);
+  if(n->base == NULL && n->nameIndex != NULL) freeNameIndex(n->nameIndex);
+  if(n->base == NULL && n->schedule != NULL) freeSchedule(n->schedule);
+  if(n->hierarchy != NULL) freeHierarchy(n->hierarchy);
+  if(n->cache != NULL) freeCache(n->cache);
+  if(n->base == NULL && n->table != NULL) freeTable(n->table);
+  if(n->graph != NULL) freeGraph(n->graph);
+}
+
+
+// Get a reference to the network queries are answered from now
+NETWORK* acquireNetwork() {
+  pthread_mutex_lock(&networkLock);
+  NETWORK *n = network;
+  n->refs++;
+  pthread_mutex_unlock(&networkLock);
+  return n;
+}
+
+// Drop a reference to a network, which is freed with the last one
+void releaseNetwork(NETWORK* n) {
+  pthread_mutex_lock(&networkLock);
+  bool last = --n->refs == 0;
+  pthread_mutex_unlock(&networkLock);
+  if(!last) return;
+  NETWORK *base = n->base;
+  freeLoadedNetwork(n);
+  free(n);
+  if(base != NULL) releaseNetwork(base);
+}
+
+/*
+ ******************************************************
+ * Answer the queries from n from now on, or from none
+ * if n is NULL. The reference of the caller goes with
+ * it. The network it replaces is freed once the last
+ * search answering from it is done.
+ ******************************************************
+ */
+void publishNetwork(NETWORK* n) {
+  pthread_mutex_lock(&networkLock);
+  NETWORK *old = network;
+  network = n;
+  pthread_mutex_unlock(&networkLock);
+  graph = n != NULL ? n->graph : NULL;
+  table = n != NULL && n->tableChanged == NULL ? n->table : NULL; //The graph has the times of the stations the updates changed
+  if(old != NULL) releaseNetwork(old);
+}
+
+
+int numOfNetworkNodes(NETWORK* n) {
+  return n->table != NULL ? n->table->header->numOfNodes : n->graph->numOfNodes;
+}
+
+
+void freeNetwork() {
+  publishNetwork(NULL);
+}
+
+
+// Make a search that answers queries from the network published now, and holds on to it until freeQuerySearch
+SEARCH* makeQuerySearch() {
+  NETWORK *n = acquireNetwork();
+  SEARCH *temp = makeSearch(numOfNetworkNodes(n));
+  temp->network = n;
+  if(n->schedule != NULL) temp->raptor = makeRaptorSearch(numOfNetworkNodes(n)/2);
+  if(n->cache != NULL) temp->capture = open_memstream(&temp->captured, &temp->capturedSize);
+  return temp;
+}
+
+void freeQuerySearch(SEARCH* s) {
+  NETWORK *n = s->network;
+  freeSearch(s);
+  releaseNetwork(n);
+}
+
+
+/*
+ ******************************************************
+ * Route a query between two name ids and write the
+ * itinerary. Uses the timetable if a schedule is
+ * loaded, then the table or the hierarchy if one is
+ * loaded, otherwise searches the graph for one route
+ * or, with --pareto or --alternatives, for several.
+ ******************************************************
+ */
+int routeQuery(SEARCH *search, int source, int dest, int departure) {
+  NETWORK *n = search->network;
+  return n->schedule != NULL ? answerQueryFromSchedule(n->graph, n->schedule, search, source, dest, departure)
+       : n->table != NULL ? answerQueryFromTable(n->table, n->graph, n->tableChanged, search, source, dest)
+       : n->hierarchy != NULL ? answerQueryFromHierarchy(n->graph, n->hierarchy, search, source, dest)
+       : pareto ? answerQueryWithFewerTransfers(n->graph, search, source, dest)
+       : numOfAlternatives > 1 ? answerQueryWithAlternatives(n->graph, search, source, dest)
+       : answerQueryFromGraph(n->graph, search, source, dest);
+}
+
+
+// Get the name index of a network. It is made the first time one of the threads needs it, so a batch of exact names never makes it.
+// It belongs to the network and freeLoadedNetwork frees it.
+NAMEINDEX* getNameIndex(NETWORK* n) {
+  NAMEINDEX *index;
+  pthread_mutex_lock(&nameIndexLock);
+  if(n->nameIndex == NULL) n->nameIndex = makeNameIndex(getStationNames(n));
+  index = n->nameIndex;
+  pthread_mutex_unlock(&nameIndexLock);
+  return index;
+}
+
+/*
+ ***********************************************************************
+ * Get the id of a station from a name as a rider typed it. A name that
+ * is not a station is looked up in the name index: the station with the
+ * same folded name, else the only station that starts with it, else the
+ * only nearest station within the edit distance. -1 if none of them is
+ * one station.
+ ***********************************************************************
+ */
+int resolveStation(NETWORK* n, char* name) {
+
+  int id = lookupName(getStationNames(n), name);
+  if(id != -1) return id;
+
+  NAMEINDEX *index = getNameIndex(n);
+  char folded[MAX_QUERY_LENGTH];
+  int ids[2], distances[2], node, numOfIds;
+  foldName(name, folded, sizeof(folded));
+  if(folded[0] == '\0') return -1;
+  if((node = findNameNode(index, folded)) != -1) {
+    if(index->names[node] != -1) return index->sameName[index->names[node]] == -1 ? index->names[node] : -1;
+    if(completeName(index, folded, ids, 2) == 1) return ids[0];
+  }
+  numOfIds = matchName(index, folded, ids, distances, 2);
+  return numOfIds == 1 || (numOfIds == 2 && distances[0] < distances[1]) ? ids[0] : -1;
+}
+
+/*
+ ***********************************************************************
+ * Write the stations that start with a text, or with fuzzy the ones
+ * close to it, nearest first, to the output of the search through its
+ * record. Answers "complete" and "match" lines.
+ ***********************************************************************
+ */
+void writeNameMatches(SEARCH* s, char* text, bool fuzzy, int format) {
+
+  NAMEINDEX *index = getNameIndex(s->network);
+  char folded[MAX_QUERY_LENGTH];
+  int ids[MAX_MATCHES+1], distances[MAX_MATCHES], numOfIds = 0;
+  foldName(text, folded, sizeof(folded));
+  if(!fuzzy) numOfIds = completeName(index, folded, ids, MAX_MATCHES+1);
+  else if(folded[0] != '\0') numOfIds = matchName(index, folded, ids, distances, MAX_MATCHES);
+
+  //One line {"stations":[...],"more":false}
+  if(format == FORMAT_JSON) {
+    recordText(s, "{\"stations\":[");
+    for(int i=0; i<numOfIds && i<MAX_MATCHES; i++) {
+      if(i > 0) recordText(s, ",");
+      recordJsonString(s, index->symbols->names[ids[i]]);
+    }
+    recordText(s, numOfIds > MAX_MATCHES ? "],\"more\":true}\n" : "],\"more\":false}\n");
+  }
+  else if(numOfIds == 0) {
+    recordText(s, fuzzy ? "No station is close to \"" : "No station starts with \"");
+    recordText(s, folded);
+    recordText(s, "\"\n");
+  }
+  else {
+    recordText(s, fuzzy ? "Stations close to \"" : "Stations starting with \"");
+    recordText(s, folded);
+    recordText(s, "\":\n");
+    for(int i=0; i<numOfIds && i<MAX_MATCHES; i++) {
+      recordText(s, index->symbols->names[ids[i]]);
+      recordText(s, "\n");
+    }
+    if(numOfIds > MAX_MATCHES) recordText(s, "...\n");
+  }
+  flushRecord(s);
+}
+
+
+/*
+ ******************************************************
+ * Find the path and write to the file. With a cache
+ * a repeated query is answered from it, and a new one
+ * is written to the capture stream of the search
+ * first, then copied to the output and the cache. The
+ * departure time is only used with a schedule.
+ ******************************************************
+ */
+int answerQuery(SEARCH *search, char* sourceName, char* destinationName, int departure) {
+
+  STAT_START(queryStart);
+  STAT_START(lookupStart);
+  CACHE *cache = search->network->cache;
+  int source = resolveStation(search->network, sourceName), dest = resolveStation(search->network, destinationName), result;
+  STAT_STOP(&search->stats, PHASE_LOOKUP, lookupStart);
+
+  if(source == -1) result = QUERY_SOURCE_NOT_FOUND;
+  else if(dest == -1) result = QUERY_DESTINATION_NOT_FOUND;
+  else if(source == dest) result = QUERY_SAME_STATION;
+  else if(cache == NULL) result = routeQuery(search, source, dest, departure);
+  else if((result = findCachedAnswer(cache, search, source, dest, departure)) == -1) {
+    FILE *output = search->output;
+    search->output = search->capture;
+    fseek(search->capture, 0, SEEK_SET);
+    search->pathLength = 0;
+    result = routeQuery(search, source, dest, departure);
+    fflush(search->capture);
+    search->output = output;
+    fwrite(search->captured, 1, search->capturedSize, output);
+    if(storeAnswer(cache, source, dest, departure, result, search->captured, search->capturedSize, search->path, search->pathLength))
+      STAT_ADD(&search->stats, COUNT_CACHE_EVICTIONS, 1);
+  }
+  STAT_STOP(&search->stats, PHASE_QUERY, queryStart);
+  return result;
+}
+
+
+/*
+ ***********************************************************************
+ * Answer one "source destination" line and write the answer, followed
+ * by a blank line, to the output file. A bad pair gives an error line
+ * instead. Returns false for a blank line or a comment, which get no
+ * answer.
+ ***********************************************************************
+ */
+bool answerQueryLine(SEARCH* search, char* query, int lineNumber) {
+
+  char sourceName[100], destinationName[100], time[16], message[2*MAX_QUERY_LENGTH];
+  int departure = -1, result = QUERY_BAD_LINE;
+
+  int n = sscanf(query, "%99s %99s %15s", sourceName, destinationName, time);
+  if(n <= 0 || sourceName[0] == '#') return false; //Blank line or comment
+
+  //Station names starting with or close to the rest of the line
+  if(strcmp(sourceName, "complete") == 0 || strcmp(sourceName, "match") == 0) {
+    if(n < 2) snprintf(message, sizeof(message), "expected a name after %s", sourceName);
+    else if(outputFormat == FORMAT_CSV || outputFormat == FORMAT_BINARY) snprintf(message, sizeof(message), "%s lines need --format text or json", sourceName);
+    else result = QUERY_OK;
+    if(result == QUERY_OK) writeNameMatches(search, strstr(query, sourceName) + strlen(sourceName), sourceName[0] == 'm', outputFormat);
+    else writeQueryError(search, result, lineNumber, message);
+  }
+  else if(n < 2) writeQueryError(search, result, lineNumber, "expected a source and a destination station");
+  else if(search->network->schedule != NULL && (n < 3 || (departure = parseTime(time)) == -1))
+    writeQueryError(search, result, lineNumber, "expected a departure time (HH:MM) after the stations");
+  else {
+    switch(result = answerQuery(search, sourceName, destinationName, departure)) {
+      case QUERY_SOURCE_NOT_FOUND:
+        snprintf(message, sizeof(message), "station not found: %s", sourceName);
+        break;
+      case QUERY_DESTINATION_NOT_FOUND:
+        snprintf(message, sizeof(message), "station not found: %s", destinationName);
+        break;
+      case QUERY_NO_PATH:
+        snprintf(message, sizeof(message), "no path found from %s to %s", sourceName, destinationName);
+        break;
+      case QUERY_SAME_STATION:
+        snprintf(message, sizeof(message), "source and destination is same: %s", sourceName);
+        break;
+    }
+    if(result != QUERY_OK) writeQueryError(search, result, lineNumber, message);
+  }
+  if(separateAnswers) fputc('\n', search->output);
+  return true;
+}
+
+
+/*
+ ***********************************************************************
+ * Answer every "source destination" line of the query file. The network
+ * is loaded only once. A bad pair gives an error line in the output
+ * file instead of stopping the batch.
+ ***********************************************************************
+ */
+void runBatch(FILE* queries, SEARCH* search) {
+
+  char query[MAX_QUERY_LENGTH];
+  int lineNumber = 0;
+
+  while(fgets(query, sizeof(query), queries) != NULL)
+    answerQueryLine(search, query, ++lineNumber);
+}
+
+
+/*
+ ***********************************************************************
+ * Threaded batch. The threads are started once and each has its own
+ * SEARCH. A window of queries is read into memory and cut into chunks,
+ * and every thread takes the next chunk that nobody has taken yet,
+ * writing its answers to a memory stream of the chunk. There are two
+ * windows: while the threads answer one, the main thread writes out
+ * the answers of the other in the order of the queries and reads the
+ * next queries into it.
+ ***********************************************************************
+ */
+typedef struct {
+  char *text; //Answers of the chunk
+  size_t length;
+} CHUNK;
+
+typedef struct {
+  char (*queries)[MAX_QUERY_LENGTH];
+  int firstLineNumber; //Line number of queries[0] in the query file
+  int numOfQueries;
+  int numOfChunks;
+  CHUNK chunks[BATCH_WINDOW/BATCH_CHUNK];
+} WINDOW;
+
+typedef struct {
+  WINDOW windows[2];
+  WINDOW *current; //Window the threads answer, NULL to stop them
+  int nextChunk; //Next chunk of it nobody has taken
+  int busy; //Threads not done with it
+  int round; //Counted up every time the threads get a window
+  pthread_mutex_t lock;
+  pthread_cond_t ready; //The threads got a window
+  pthread_cond_t done; //The last thread is done with its window
+} BATCH;
+
+typedef struct {
+  BATCH *batch;
+  SEARCH *search;
+  pthread_t thread;
+} WORKER;
+
+// Answer the chunks of every window the threads get, until they are stopped
+void* runWorker(void* argument) {
+  WORKER *worker = (WORKER*) argument;
+  BATCH *batch = worker->batch;
+  int round = 0;
+
+  pthread_mutex_lock(&batch->lock);
+  for(;;) {
+    while(batch->round == round) pthread_cond_wait(&batch->ready, &batch->lock);
+    round = batch->round;
+    WINDOW *window = batch->current;
+    if(window == NULL) break;
+
+    for(int c; (c = batch->nextChunk++) < window->numOfChunks; ) {
+      pthread_mutex_unlock(&batch->lock);
+      CHUNK *chunk = &window->chunks[c];
+      worker->search->output = open_memstream(&chunk->text, &chunk->length);
+      int last = (c+1)*BATCH_CHUNK < window->numOfQueries ? (c+1)*BATCH_CHUNK : window->numOfQueries;
+      for(int q=c*BATCH_CHUNK; q<last; q++)
+        answerQueryLine(worker->search, window->queries[q], window->firstLineNumber + q);
+      fclose(worker->search->output);
+      pthread_mutex_lock(&batch->lock);
+    }
+    if(--batch->busy == 0) pthread_cond_signal(&batch->done);
+  }
+  pthread_mutex_unlock(&batch->lock);
+  return NULL;
+}
+
+// Give a window to the threads, or NULL to stop them
+void startWindow(BATCH* batch, WINDOW* window, int numOfThreads) {
+  pthread_mutex_lock(&batch->lock);
+  batch->current = window;
+  batch->nextChunk = 0;
+  batch->busy = numOfThreads;
+  batch->round++;
+  pthread_cond_broadcast(&batch->ready);
+  pthread_mutex_unlock(&batch->lock);
+}
+
+// Read the next window of queries, returns how many there are
+int readWindow(WINDOW* window, FILE* queries, int firstLineNumber) {
+  window->firstLineNumber = firstLineNumber;
+  window->numOfQueries = 0;
+  while(window->numOfQueries < BATCH_WINDOW && fgets(window->queries[window->numOfQueries], MAX_QUERY_LENGTH, queries) != NULL)
+    window->numOfQueries++;
+  window->numOfChunks = (window->numOfQueries + BATCH_CHUNK - 1) / BATCH_CHUNK;
+  return window->numOfQueries;
+}
+
+void runParallelBatch(FILE* queries, int numOfThreads) {
+
+  BATCH *batch = NEW(BATCH);
+  WORKER *workers = (WORKER*) malloc(sizeof(WORKER) * numOfThreads);
+  for(int i=0; i<2; i++) batch->windows[i].queries = malloc(sizeof(*batch->windows[i].queries) * BATCH_WINDOW);
+  batch->round = 0;
+  pthread_mutex_init(&batch->lock, NULL);
+  pthread_cond_init(&batch->ready, NULL);
+  pthread_cond_init(&batch->done, NULL);
+  for(int w=0; w<numOfThreads; w++) {
+    workers[w].batch = batch;
+    workers[w].search = makeQuerySearch();
+    pthread_create(&workers[w].thread, NULL, runWorker, &workers[w]);
+  }
+
+  WINDOW *window = &batch->windows[0];
+  int lineNumber = 1 + readWindow(window, queries, 1);
+  if(window->numOfQueries > 0) startWindow(batch, window, numOfThreads);
+  while(window->numOfQueries > 0) {
+    WINDOW *next = window == &batch->windows[0] ? &batch->windows[1] : &batch->windows[0];
+    lineNumber += readWindow(next, queries, lineNumber);
+
+    pthread_mutex_lock(&batch->lock);
+    while(batch->busy > 0) pthread_cond_wait(&batch->done, &batch->lock);
+    pthread_mutex_unlock(&batch->lock);
+    if(next->numOfQueries > 0) startWindow(batch, next, numOfThreads);
+
+    for(int c=0; c<window->numOfChunks; c++) {
+      fwrite(window->chunks[c].text, 1, window->chunks[c].length, out);
+      free(window->chunks[c].text);
+    }
+    window = next;
+  }
+  startWindow(batch, NULL, numOfThreads);
+
+  for(int w=0; w<numOfThreads; w++) {
+    pthread_join(workers[w].thread, NULL);
+    freeQuerySearch(workers[w].search);
+  }
+  pthread_cond_destroy(&batch->ready);
+  pthread_cond_destroy(&batch->done);
+  pthread_mutex_destroy(&batch->lock);
+  for(int i=0; i<2; i++) free(batch->windows[i].queries);
+  free(batch);
+  free(workers);
+}
+
+
+int compareLatency(const void* a, const void* b) {
+  double x = *(const double*) a, y = *(const double*) b;
+  return (x > y) - (x < y);
+}
+
+
+/*
+ ***********************************************************************
+ * Benchmark. Answer every query of the file on its own and time it,
+ * then answer the whole file as a threaded batch. The answers go to
+ * /dev/null. Prints one report line that is easy to compare between
+ * builds.
+ ***********************************************************************
+ */
+void runBenchmark(char* name, FILE* queries, int numOfThreads, double loadTime) {
+
+  char query[MAX_QUERY_LENGTH];
+  int numOfQueries = 0, maxQueries = 1024;
+  double *latency = (double*) malloc(sizeof(double) * maxQueries);
+  struct rusage usage;
+  SEARCH *search = makeQuerySearch();
+
+  out = fopen("/dev/null", "w");
+  search->output = out;
+  while(fgets(query, sizeof(query), queries) != NULL) {
+    double start = getMicroseconds();
+    if(!answerQueryLine(search, query, numOfQueries + 1)) continue;
+    if(numOfQueries == maxQueries) {
+      maxQueries *= 2;
+      latency = (double*) realloc(latency, sizeof(double) * maxQueries);
+    }
+    latency[numOfQueries++] = getMicroseconds() - start;
+  }
+  freeQuerySearch(search);
+  if(numOfQueries == 0) {
+    printf("\nNo queries to run\n");
+    exit(0);
+  }
+  qsort(latency, numOfQueries, sizeof(double), compareLatency);
+
+  rewind(queries);
+  double start = getMicroseconds();
+  if(numOfThreads > 1) runParallelBatch(queries, numOfThreads);
+  else {
+    search = makeQuerySearch();
+    runBatch(queries, search);
+    freeQuerySearch(search);
+  }
+  fflush(out);
+  double batchTime = getMicroseconds() - start;
+  fclose(out);
+
+  getrusage(RUSAGE_SELF, &usage);
+  printf("%s: load %.1f ms, query p50 %.1f us p99 %.1f us max %.1f us (%d queries), batch %.0f queries/s (%d threads), peak RSS %ld KB\n",
+    name, loadTime / 1e3, latency[numOfQueries/2], latency[(int) (numOfQueries*0.99)], latency[numOfQueries-1], numOfQueries,
+    numOfQueries / (batchTime / 1e6), numOfThreads > 1 ? numOfThreads : 1, usage.ru_maxrss);
+  free(latency);
+}
+
+
+/*
+ ***********************************************************************
+ * One-to-all travel times (--isochrone). One search from the sources
+ * gives the time to every station name, written as one array indexed
+ * by name id: a CSV of "station,seconds" rows or the raw ints. The
+ * name ids follow the order the names first appear in metro.txt.
+ ***********************************************************************
+ */
+
+/*
+ *****************************************************************
+ * Dijkstra from the departure nodes of every source in turn. times
+ * gets the time of the route to every station name, as a query for
+ * it would give it, from the nearest source: 0 at the sources and
+ * -1 when the name is not reached within cutoff seconds. One search
+ * per source, since the lowest cost from all of them together can
+ * be a route with fewer transfers that takes longer. The search
+ * costs hold the TRANSFER_PENALTY, so a search goes on until the
+ * heap is empty, but does not leave a node whose route takes
+ * longer than the cutoff.
+ *****************************************************************
+ */
+void findTravelTimes(GRAPH* g, SEARCH* s, int sources[], int numOfSources, int cutoff, int times[]) {
+
+  int *routeTime = (int*) malloc(sizeof(int) * g->numOfNodes);
+  int *lastSource = (int*) malloc(sizeof(int) * g->numOfNames); //Last source that reached every name
+  for(int n=0; n<g->numOfNames; n++) times[n] = lastSource[n] = -1;
+
+  for(int k=0; k<numOfSources; k++) {
+    resetSearch(s);
+    times[sources[k]] = 0;
+    for(int i=g->nameStart[sources[k]]; i<g->nameStart[sources[k]+1]; i++)
+      if(!IS_CLOSED(g, g->nameStations[i])) heapDecrease(s, DEPARTURE(g->nameStations[i]), 0, -1);
+
+    while(s->heapSize > 0) {
+      int node = heapPop(s);
+      s->settled[s->numSettled++] = node;
+      routeTime[node] = getRouteTime(s, routeTime, node);
+      if(routeTime[node] > cutoff) continue;
+      if(IS_ARRIVAL(node) && !IS_CLOSED(g, STATION_OF_NODE(node))) {
+        int name = g->stations[STATION_OF_NODE(node)].name;
+        if(lastSource[name] != k) { //First arrival settled is the one a query stops at
+          lastSource[name] = k;
+          if(times[name] == -1 || routeTime[node] < times[name]) times[name] = routeTime[node];
+        }
+      }
+      STAT_ADD(&s->stats, COUNT_EDGES_SCANNED, g->edgeStart[node+1] - g->edgeStart[node]);
+      for(int e=g->edgeStart[node]; e<g->edgeStart[node+1]; e++) {
+        if(g->edgeWeight[e] == CLOSED) continue;
+        int dist = s->dist[node] + EDGE_COST(g, node, e);
+        if(dist < s->dist[g->edgeTarget[e]])
+          heapDecrease(s, g->edgeTarget[e], dist, node);
+      }
+    }
+    STAT_ADD(&s->stats, COUNT_NODES_SETTLED, s->numSettled);
+  }
+  free(routeTime);
+  free(lastSource);
+}
+
+// Same as findTravelTimes from the rows of a table, the nearest source wins
+void findTravelTimesFromTable(TABLE* t, int sources[], int numOfSources, int cutoff, int times[]) {
+  int numOfNames = t->header->numOfNames;
+  for(int n=0; n<numOfNames; n++) times[n] = -1;
+  for(int k=0; k<numOfSources; k++) {
+    int *row = &t->time[(size_t) sources[k] * numOfNames];
+    for(int n=0; n<numOfNames; n++)
+      if(row[n] != -1 && row[n] <= cutoff && (times[n] == -1 || row[n] < times[n])) times[n] = row[n];
+  }
+}
+
+/*
+ *****************************************************************
+ * Write the travel times from a comma separated list of source
+ * stations to every station, within cutoff seconds, to fileName.
+ *****************************************************************
+ */
+void writeTravelTimes(char* sourceList, int cutoff, bool binary, char* fileName) {
+
+  SYMBOLS *names = getStationNames(network);
+  int *sources = (int*) malloc(sizeof(int) * names->numOfNames), numOfSources = 0;
+  int *times = (int*) malloc(sizeof(int) * names->numOfNames);
+  bool *isSource = (bool*) calloc(names->numOfNames, sizeof(bool));
+
+  //A station given twice is searched once, so there are never more sources than names
+  for(char *name = strtok(sourceList, ","); name != NULL; name = strtok(NULL, ",")) {
+    int source = resolveStation(network, name);
+    if(source == -1) {
+      printf("\nStation not found: %s\n", name);
+      exit(0);
+    }
+    if(isSource[source]) continue;
+    isSource[source] = true;
+    sources[numOfSources++] = source;
+  }
+  free(isSource);
+  if(numOfSources == 0) {
+    printf("\nNo source station given to --isochrone\n");
+    exit(0);
+  }
+
+  STAT_START(routeStart);
+  if(table != NULL) findTravelTimesFromTable(table, sources, numOfSources, cutoff, times);
+  else {
+    SEARCH *search = makeSearch(graph->numOfNodes);
+    findTravelTimes(graph, search, sources, numOfSources, cutoff, times);
+    freeSearch(search);
+  }
+  STAT_STOP(&stats, PHASE_ROUTE, routeStart);
+
+  FILE *file = strcmp(fileName, "-") == 0 ? stdout : fopen(fileName, binary ? "wb" : "w");
+  if(file == NULL) {
+    printf("\n%s file could not be opened\n", fileName);
+    exit(0);
+  }
+  STAT_START(outputStart);
+  if(binary) fwrite(times, sizeof(int), names->numOfNames, file);
+  else {
+    fprintf(file, "station,seconds\n");
+    for(int n=0; n<names->numOfNames; n++) fprintf(file, "%s,%d\n", names->names[n], times[n]);
+  }
+  if(fclose(file) != 0) {
+    printf("\n%s file could not be written\n", fileName);
+    exit(0);
+  }
+  STAT_STOP(&stats, PHASE_OUTPUT, outputStart);
+
+  free(sources);
+  free(times);
+}
+
+
+/*
+ ***********************************************************************
+ * Travel time matrix (--matrix). The sources are searched MATRIX_LANES
+ * at a time: every node keeps one distance per source in a vector, so
+ * one relaxation of an edge is a vector add, compare and blend for all
+ * of them. There is no heap to order the nodes. The nodes are swept by
+ * station id, up then down, relaxing the edges of the nodes that got
+ * nearer since their last relaxation, until a sweep changes nothing.
+ * The stations of a line have consecutive ids, so a sweep carries the
+ * times along a whole line in one direction and only the transfers
+ * take more sweeps. Threads take blocks of sources.
+ ***********************************************************************
+ */
+#define MATRIX_LANES 16 //Sources of one block, one pass over the edges serves all of them
+#define MATRIX_UNREACHED (INT_MAX/2) //Far enough that adding an edge weight cannot overflow
+
+typedef int LANES __attribute__((vector_size(MATRIX_LANES * sizeof(int))));
+
+typedef struct {
+  GRAPH *g;
+  int *time; //numOfNames rows of numOfNames times, same as a table
+  int numOfBlocks;
+  int nextBlock; //Next block nobody has taken
+  pthread_mutex_t lock;
+} MATRIX;
+
+typedef struct {
+  MATRIX *matrix;
+  LANES *dist; //Cost of every node from every source of the block, see COST_SCALE
+  LANES *transfers; //Transfers on the way to every node, to take the penalty out of the times
+  int *cost; //Lowest cost to every station name from the source being written
+  unsigned char *nearer; //Node got nearer to some source since its edges were last relaxed
+  STATS stats;
+  pthread_t thread;
+} MATRIXWORKER;
+
+// True if any lane of a comparison is true
+bool anyLane(LANES* mask) {
+  for(int k=0; k<MATRIX_LANES; k++)
+    if((*mask)[k]) return true;
+  return false;
+}
+
+// Relax the edges going out of a node for all the lanes at once
+void relaxLanes(GRAPH* g, MATRIXWORKER* worker, int node) {
+  LANES from = worker->dist[node], fromTransfers = worker->transfers[node];
+  worker->nearer[node] = 0;
+  STAT_ADD(&worker->stats, COUNT_NODES_SETTLED, 1);
+  STAT_ADD(&worker->stats, COUNT_EDGES_SCANNED, g->edgeStart[node+1] - g->edgeStart[node]);
+  for(int e=g->edgeStart[node]; e<g->edgeStart[node+1]; e++) {
+    if(g->edgeWeight[e] == CLOSED) continue;
+    LANES *to = &worker->dist[g->edgeTarget[e]], *toTransfers = &worker->transfers[g->edgeTarget[e]];
+    LANES dist = from + EDGE_COST(g, node, e);
+    LANES better = dist < *to;
+    if(!anyLane(&better)) continue;
+    LANES transfers = fromTransfers + IS_TRANSFER(node, g->edgeTarget[e]);
+    *to = (dist & better) | (*to & ~better);
+    *toTransfers = (transfers & better) | (*toTransfers & ~better);
+    worker->nearer[g->edgeTarget[e]] = 1;
+  }
+}
+
+/*
+ *****************************************************************
+ * Times from the source names first to first+count-1 to every
+ * station name, into their rows of the matrix.
+ *****************************************************************
+ */
+void findMatrixBlock(GRAPH* g, MATRIXWORKER* worker, int* time, int first, int count) {
+
+  LANES unreached, none;
+  for(int k=0; k<MATRIX_LANES; k++) {
+    unreached[k] = MATRIX_UNREACHED;
+    none[k] = 0;
+  }
+  for(int node=0; node<g->numOfNodes; node++) {
+    worker->dist[node] = unreached;
+    worker->transfers[node] = none;
+  }
+  memset(worker->nearer, 0, g->numOfNodes);
+  for(int k=0; k<count; k++) {
+    for(int i=g->nameStart[first+k]; i<g->nameStart[first+k+1]; i++) {
+      int node = DEPARTURE(g->nameStations[i]);
+      if(IS_CLOSED(g, g->nameStations[i])) continue;
+      worker->dist[node][k] = 0;
+      worker->nearer[node] = 1;
+    }
+  }
+
+  for(bool up = true, changed = true; changed; up = !up) {
+    changed = false;
+    for(int i=0; i<g->numOfStations; i++) {
+      int id = up ? i : g->numOfStations-1 - i; //Arrival before departure both ways, so a dwell never waits a sweep
+      if(worker->nearer[ARRIVAL(id)]) { relaxLanes(g, worker, ARRIVAL(id)); changed = true; }
+      if(worker->nearer[DEPARTURE(id)]) { relaxLanes(g, worker, DEPARTURE(id)); changed = true; }
+    }
+  }
+
+  for(int k=0; k<count; k++) {
+    int *row = &time[(size_t) (first+k) * g->numOfNames];
+    for(int to=0; to<g->numOfNames; to++) row[to] = -1;
+    for(int id=0; id<g->numOfStations; id++) {
+      int dist = worker->dist[ARRIVAL(id)][k], to = g->stations[id].name;
+      if(dist == MATRIX_UNREACHED || IS_CLOSED(g, id)) continue;
+      if(row[to] == -1 || dist < worker->cost[to]) { //The arrival a query stops at
+        worker->cost[to] = dist;
+        row[to] = (dist - TRANSFER_COST * worker->transfers[ARRIVAL(id)][k]) / COST_SCALE;
+      }
+    }
+    row[first+k] = 0;
+  }
+}
+
+// Search blocks of sources until there are none left
+void* runMatrixWorker(void* argument) {
+  MATRIXWORKER *worker = (MATRIXWORKER*) argument;
+  MATRIX *matrix = worker->matrix;
+
+  for(;;) {
+    pthread_mutex_lock(&matrix->lock);
+    int b = matrix->nextBlock++;
+    pthread_mutex_unlock(&matrix->lock);
+    if(b >= matrix->numOfBlocks) return NULL;
+
+    int first = b * MATRIX_LANES, count = matrix->g->numOfNames - first;
+    findMatrixBlock(matrix->g, worker, matrix->time, first, count < MATRIX_LANES ? count : MATRIX_LANES);
+  }
+}
+
+// Times between all the station names, in rows of numOfNames
+int* findTravelTimeMatrix(GRAPH* g, int numOfThreads) {
+
+  MATRIX matrix;
+  MATRIXWORKER *workers = (MATRIXWORKER*) calloc(numOfThreads, sizeof(MATRIXWORKER));
+  matrix.g = g;
+  matrix.time = (int*) malloc(sizeof(int) * (size_t) g->numOfNames * g->numOfNames);
+  matrix.numOfBlocks = (g->numOfNames + MATRIX_LANES - 1) / MATRIX_LANES;
+  matrix.nextBlock = 0;
+  pthread_mutex_init(&matrix.lock, NULL);
+  if(matrix.time == NULL || workers == NULL) {
+    printf("\nNot enough memory for a matrix of %d stations\n", g->numOfNames);
+    exit(0);
+  }
+
+  for(int w=0; w<numOfThreads; w++) {
+    workers[w].matrix = &matrix;
+    workers[w].nearer = (unsigned char*) malloc(g->numOfNodes);
+    workers[w].cost = (int*) malloc(sizeof(int) * g->numOfNames);
+    if(posix_memalign((void**) &workers[w].dist, sizeof(LANES), sizeof(LANES) * (size_t) g->numOfNodes) != 0
+       || posix_memalign((void**) &workers[w].transfers, sizeof(LANES), sizeof(LANES) * (size_t) g->numOfNodes) != 0
+       || workers[w].nearer == NULL || workers[w].cost == NULL) {
+      printf("\nNot enough memory for %d threads of matrix search\n", numOfThreads);
+      exit(0);
+    }
+    pthread_create(&workers[w].thread, NULL, runMatrixWorker, &workers[w]);
+  }
+  for(int w=0; w<numOfThreads; w++) {
+    pthread_join(workers[w].thread, NULL);
+    mergeStats(&stats, &workers[w].stats);
+    free(workers[w].dist);
+    free(workers[w].transfers);
+    free(workers[w].nearer);
+    free(workers[w].cost);
+  }
+
+  pthread_mutex_destroy(&matrix.lock);
+  free(workers);
+  return matrix.time;
+}
+
+/*
+ *****************************************************************
+ * Write the times between all the stations to fileName, from the
+ * table if one is loaded. The CSV has a header row of the names
+ * and a row per source; --binary writes the rows of ints only.
+ *****************************************************************
+ */
+void writeTravelTimeMatrix(int numOfThreads, bool binary, char* fileName) {
+
+  SYMBOLS *names = table != NULL ? table->symbols : graph->stationNames;
+  int numOfNames = names->numOfNames;
+
+  STAT_START(routeStart);
+  int *time = table != NULL ? table->time : findTravelTimeMatrix(graph, numOfThreads);
+  STAT_STOP(&stats, PHASE_ROUTE, routeStart);
+
+  FILE *file = strcmp(fileName, "-") == 0 ? stdout : fopen(fileName, binary ? "wb" : "w");
+  if(file == NULL) {
+    printf("\n%s file could not be opened\n", fileName);
+    exit(0);
+  }
+  STAT_START(outputStart);
+  if(binary) fwrite(time, sizeof(int), (size_t) numOfNames * numOfNames, file);
+  else {
+    fprintf(file, "station");
+    for(int n=0; n<numOfNames; n++) fprintf(file, ",%s", names->names[n]);
+    for(int from=0; from<numOfNames; from++) {
+      fprintf(file, "\n%s", names->names[from]);
+      for(int to=0; to<numOfNames; to++) fprintf(file, ",%d", time[(size_t) from * numOfNames + to]);
+    }
+    fprintf(file, "\n");
+  }
+  if(fclose(file) != 0) {
+    printf("\n%s file could not be written\n", fileName);
+    exit(0);
+  }
+  STAT_STOP(&stats, PHASE_OUTPUT, outputStart);
+
+  if(table == NULL) free(time);
+}
+
+
+/*
+ ***********************************************************************
+ * Service updates (--updates and "update" requests to the server). An
+ * update is one line:
+ *   close station S [L]          reopen station S [L]
+ *   close segment S1 S2 L        reopen segment S1 S2 L
+ *   transfer S L1 L2 seconds     stop S L seconds
+ * A station without a line is closed on all its lines. A segment is
+ * the track between two stations next to each other on line L. The
+ * graph of a network nobody answers from yet is patched in place, and
+ * the server patches a copy (see copyNetwork): the flags and times of
+ * the stations change and only the edges of the stations involved get
+ * new weights.
+ * A cached answer stays valid when an update makes other stations
+ * slower, so only the answers through the stations involved are
+ * dropped. An update that makes anything faster drops all of them.
+ ***********************************************************************
+ */
+
+/*
+ ******************************************************
+ * Before the first update, make room for the flags and
+ * copy the parts of a mapped network image that
+ * updates write to, since the image is read only.
+ ******************************************************
+ */
+void makeGraphWritable(GRAPH* g) {
+  if(g->closed != NULL) return;
+  g->closed = (unsigned char*) arenaCalloc(g->arena, g->numOfStations, 1);
+  if(!g->readOnly) return;
+  g->readOnly = false;
+  g->stations = (GRAPHSTATION*) memcpy(arenaAlloc(g->arena, sizeof(GRAPHSTATION) * g->numOfStations), g->stations, sizeof(GRAPHSTATION) * g->numOfStations);
+  g->transfers = (GRAPHTRANSFER*) memcpy(arenaAlloc(g->arena, sizeof(GRAPHTRANSFER) * g->numOfTransfers), g->transfers, sizeof(GRAPHTRANSFER) * g->numOfTransfers);
+  g->edgeWeight = (int*) memcpy(arenaAlloc(g->arena, sizeof(int) * g->numOfEdges), g->edgeWeight, sizeof(int) * g->numOfEdges);
+}
+
+/*
+ ******************************************************
+ * Copy a graph for an update to a published network.
+ * The copy has an arena of its own with the parts
+ * updates write to, and shares the rest with g, which
+ * must outlive it.
+ ******************************************************
+ */
+GRAPH* copyGraph(GRAPH* g) {
+  ARENA *arena = makeArena(g->arena->stats);
+  GRAPH *temp = (GRAPH*) memcpy(arenaAlloc(arena, sizeof(GRAPH)), g, sizeof(GRAPH));
+  temp->arena = arena;
+  temp->map = NULL; //Unmapped with g
+  temp->mapSize = 0;
+  temp->readOnly = false;
+  temp->stations = (GRAPHSTATION*) memcpy(arenaAlloc(arena, sizeof(GRAPHSTATION) * g->numOfStations), g->stations, sizeof(GRAPHSTATION) * g->numOfStations);
+  temp->transfers = (GRAPHTRANSFER*) memcpy(arenaAlloc(arena, sizeof(GRAPHTRANSFER) * g->numOfTransfers), g->transfers, sizeof(GRAPHTRANSFER) * g->numOfTransfers);
+  temp->edgeWeight = (int*) memcpy(arenaAlloc(arena, sizeof(int) * g->numOfEdges), g->edgeWeight, sizeof(int) * g->numOfEdges);
+  temp->closed = (unsigned char*) arenaCalloc(arena, g->numOfStations, 1);
+  if(g->closed != NULL) memcpy(temp->closed, g->closed, g->numOfStations);
   return temp;
 }
 
-// Create a TransferStation
-TRANSFERSTATION* makeTransferStation(STATION *station, char* stationName, char* lineName) {
-  TRANSFERSTATION *temp;
-  temp = NEW(TRANSFERSTATION);
-  if(temp!=NULL) {
-    temp->station = station;
-    temp->stationName = stationName;
-    temp->lineName = lineName;
-  }
-  return temp;
+// Station id of a station name on a line, -1 if the line does not stop there
+int findStation(GRAPH* g, char* stationName, char* lineName) {
+  int name = lookupName(g->stationNames, stationName), line = lookupName(g->lineNames, lineName);
+  if(name == -1 || line == -1) return -1;
+  for(int i=g->nameStart[name]; i<g->nameStart[name+1]; i++)
+    if(g->stations[g->nameStations[i]].line == line) return g->nameStations[i];
+  return -1;
 }
 
-// Create new node with the passed data and insert at the tail of the list
-STATION* insertStationInLine(LINE *line, char* lineName, char* stationName, int stationNumber, int numOfTransferLines, int timeToReach, int stopTime, char* transferLines[], int transferTimes[]) {
-
-  STATION *temp;
-  temp = makeStation(lineName,stationName,stationNumber,numOfTransferLines,timeToReach,stopTime,transferLines,transferTimes);
-  
-  if (temp == NULL) return NULL; // fail, cannot create new NODE
-
-  if (line == NULL) {
-    line = makeLine();
-    if (line == NULL) return NULL;   // fail, cannot create ROOT
+// Weight of the edge from -> to for the times and flags the stations have now, see buildEdges
+int getEdgeWeight(GRAPH* g, int from, int to) {
+  int a = STATION_OF_NODE(from), b = STATION_OF_NODE(to);
+  if(a == b) return g->stations[a].stopTime; //Dwell
+  if(IS_ARRIVAL(from)) { //Transfer
+    if(IS_CLOSED(g, a) || IS_CLOSED(g, b)) return CLOSED;
+    for(int t=g->stations[a].firstTransfer; t<g->stations[a].firstTransfer+g->stations[a].numOfTransfers; t++)
+      if(g->transfers[t].station == b) return g->transfers[t].transferTime;
   }
+  if(g->closed[a < b ? a : b] & CLOSED_SEGMENT) return CLOSED; //Ride
+  return RIDE_TIME(&g->stations[a], &g->stations[b]);
+}
 
-  (line->numOfStations)++;
-
-  if (line->numOfStations == 1)              // if previously the list is empty
-    line->start = line->end = temp;
+// Set again the weights of the edges going out of a node
+void refreshNode(GRAPH* g, int node) {
+  for(int e=g->edgeStart[node]; e<g->edgeStart[node+1]; e++)
+    g->edgeWeight[e] = getEdgeWeight(g, node, g->edgeTarget[e]);
+}
 
-  else {
-    line->end->next = temp;
-    temp->prev = line->end;
-    line->end = temp;
+// Set again the weights of every edge going into or out of a station
+void refreshStation(GRAPH* g, int id) {
+  GRAPHSTATION *station = &g->stations[id];
+  GRAPHLINE *current = &g->lines[station->line];
+  for(int i=g->nameStart[station->name]; i<g->nameStart[station->name+1]; i++) { //Transfers both ways
+    refreshNode(g, ARRIVAL(g->nameStations[i]));
+    refreshNode(g, DEPARTURE(g->nameStations[i]));
   }
-  return temp;
+  if(id > current->start) refreshNode(g, DEPARTURE(id-1));
+  if(id < current->start + current->numOfStations - 1) refreshNode(g, DEPARTURE(id+1));
 }
 
 
 /*
- **************************************************************************
- * There are 9 MAIN transfer stations in the map. Considering only those.
- **************************************************************************
+ ***********************************************************************
+ * Apply one update to the graph of a network and drop the cached
+ * answers it makes wrong. The network must not be published yet: the
+ * server updates a copy of the one it answers from (see copyNetwork).
+ * A loaded hierarchy or table was made for the old times. It is kept
+ * when the update can only slow trips down, and the trips through the
+ * changed stations are searched in the graph, otherwise it is dropped
+ * and all queries search the graph. Writes what was done, or what is wrong
+ * with the update, to message. Returns false for a bad update, which
+ * changes nothing.
+ ***********************************************************************
  */
-bool isStationValidTransferStation(char* stationName) {
+bool applyUpdate(NETWORK* n, char* update, char* message, size_t size) {
 
-  if(strcmp(stationName,"Fort_Totten") == 0) return true;
-  else if(strcmp(stationName,"East_Falls_Church") == 0) return true;
-  else if(strcmp(stationName,"Rosslyn") == 0) return true;
-  else if(strcmp(stationName,"Metro_Center") == 0) return true;
-  else if(strcmp(stationName,"Gallery_Place") == 0) return true;
-  else if(strcmp(stationName,"L'Enfant_Plaza") == 0) return true;
-  else if(strcmp(stationName,"Stadium_Armory") == 0) return true;
-  else if(strcmp(stationName,"Pentagon") == 0) return true;
-  else if(strcmp(stationName,"King_St_Old_Town") == 0) return true;
-  else return false;
-}
+  char text[MAX_QUERY_LENGTH], *word[6];
+  int numOfWords = 0, station = -1, other = -1, transfer = -1, time = 0, pair[2];
+  int *affected = pair, numAffected = 1; //The stations whose answers may now be wrong
+  bool faster = false;
+
+  snprintf(text, sizeof(text), "%s", update);
+  for(char *token = strtok(text, " \t\r\n"); token != NULL && token[0] != '#' && numOfWords < 6; token = strtok(NULL, " \t\r\n"))
+    word[numOfWords++] = token;
+  if(numOfWords == 0) {
+    snprintf(message, size, "empty update");
+    return false;
+  }
+  bool close = strcmp(word[0], "close") == 0, reopen = strcmp(word[0], "reopen") == 0;
+  bool stationUpdate = (close || reopen) && (numOfWords == 3 || numOfWords == 4) && strcmp(word[1], "station") == 0;
+  bool segmentUpdate = (close || reopen) && numOfWords == 5 && strcmp(word[1], "segment") == 0;
+  bool transferUpdate = strcmp(word[0], "transfer") == 0 && numOfWords == 5 && sscanf(word[4], "%d", &time) == 1 && time >= 0;
+  bool stopUpdate = strcmp(word[0], "stop") == 0 && numOfWords == 4 && sscanf(word[3], "%d", &time) == 1 && time >= 0;
+
+  //Find the stations first, so that a bad update does not even copy a mapped network
+  GRAPH *g = n->graph;
+  if(stationUpdate) {
+    int name = lookupName(g->stationNames, word[2]);
+    if(numOfWords == 4) station = findStation(g, word[2], word[3]);
+    if(name == -1 || (numOfWords == 4 && station == -1)) {
+      snprintf(message, size, "station not found: %s%s%s", word[2], numOfWords == 4 ? " on " : "", numOfWords == 4 ? word[3] : "");
+      return false;
+    }
+    pair[0] = station;
+    if(numOfWords == 3) { //All the lines. The stations of a name are next to each other in nameStations.
+      affected = &g->nameStations[g->nameStart[name]];
+      numAffected = g->nameStart[name+1] - g->nameStart[name];
+    }
+  }
+  else if(segmentUpdate) {
+    station = findStation(g, word[2], word[4]);
+    other = findStation(g, word[3], word[4]);
+    if(station == -1 || other == -1 || abs(station - other) != 1) {
+      snprintf(message, size, "%s and %s are not next to each other on %s line", word[2], word[3], word[4]);
+      return false;
+    }
+  }
+  else if(transferUpdate) {
+    station = findStation(g, word[1], word[2]);
+    other = findStation(g, word[1], word[3]);
+    for(int t=0; station != -1 && t<g->stations[station].numOfTransfers; t++)
+      if(g->transfers[g->stations[station].firstTransfer + t].station == other)
+        transfer = g->stations[station].firstTransfer + t;
+    if(transfer == -1 || other == -1) {
+      snprintf(message, size, "no transfer from %s line to %s line at %s", word[2], word[3], word[1]);
+      return false;
+    }
+  }
+  else if(stopUpdate) {
+    station = findStation(g, word[1], word[2]);
+    if(station == -1) {
+      snprintf(message, size, "station not found: %s on %s", word[1], word[2]);
+      return false;
+    }
+  }
+  else {
+    snprintf(message, size, "unknown update: %s", update);
+    return false;
+  }
 
+  makeGraphWritable(g);
+  if(stationUpdate) {
+    for(int i=0; i<numAffected; i++) {
+      if(close) g->closed[affected[i]] |= CLOSED_STATION;
+      else g->closed[affected[i]] &= ~CLOSED_STATION;
+      refreshStation(g, affected[i]);
+    }
+    faster = reopen;
+  }
+  else if(segmentUpdate) {
+    if(close) g->closed[station < other ? station : other] |= CLOSED_SEGMENT;
+    else g->closed[station < other ? station : other] &= ~CLOSED_SEGMENT;
+    refreshNode(g, DEPARTURE(station));
+    refreshNode(g, DEPARTURE(other));
+    faster = reopen;
+  }
+  else if(transferUpdate) {
+    faster = time < g->transfers[transfer].transferTime;
+    g->transfers[transfer].transferTime = time;
+    refreshNode(g, ARRIVAL(station));
+  }
+  else {
+    GRAPHLINE *current = &g->lines[g->stations[station].line];
+    int change = time - g->stations[station].stopTime;
+    faster = change < 0;
+    g->stations[station].stopTime = time;
+    for(int id=station+1; id<current->start + current->numOfStations; id++) //Keep RIDE_TIME right
+      g->stations[id].rideClock += change;
+    refreshNode(g, ARRIVAL(station));
+  }
 
+  if(affected == pair) { //One station, or both ends of a segment or a transfer
+    pair[0] = station;
+    pair[1] = other;
+    numAffected = other != -1 ? 2 : 1;
+  }
+  //A network being read has no cached answers and no hierarchy yet
+  snprintf(message, size, "%d cached answers dropped", n->cache != NULL ? invalidateCache(n->cache, faster, affected, numAffected) : 0);
 
-/*
- *************************************************************
- * Get the index of the required line from the LINE array.
- * This will give us the required LINE object from the array.
- *************************************************************
- */
-int getLineIndex(char* lineColor) {
-  if(strcmp(lineColor,"green") == 0) return 0;
-  if(strcmp(lineColor,"yellow") == 0) return 1;
-  if(strcmp(lineColor,"blue") == 0) return 2;
-  if(strcmp(lineColor,"silver") == 0) return 3;
-  if(strcmp(lineColor,"orange") == 0) return 4;
-  if(strcmp(lineColor,"red") == 0) return 5;
-  else return -1;
+  if(n->hierarchy != NULL && faster) {
+    freeHierarchy(n->hierarchy);
+    n->hierarchy = NULL;
+  }
+  else if(n->hierarchy != NULL) {
+    if(n->hierarchy->changed == NULL) n->hierarchy->changed = (unsigned char*) calloc(g->numOfStations, 1);
+    for(int i=0; i<numAffected; i++) n->hierarchy->changed[affected[i]] = 1;
+  }
+
+  //The same goes for a table. The base of a copy owns the table, and the network it was read with frees it.
+  if(n->table != NULL && faster) {
+    if(n->base == NULL) freeTable(n->table);
+    n->table = NULL;
+  }
+  else if(n->table != NULL) {
+    if(n->tableChanged == NULL) n->tableChanged = (unsigned char*) calloc(g->numOfStations, 1);
+    for(int i=0; i<numAffected; i++) n->tableChanged[affected[i]] = 1;
+  }
+  return true;
 }
 
+
 /*
- *************************************************************
- * Get the correct station as the source station.
- * Ex: to go from Fort Tottent to Pentagon, choose Fort Totten
- * of yellow line as source, not the green line.
- *************************************************************
+ ******************************************************
+ * Apply every update of a delta file. A bad update
+ * returns false with what is wrong written to message,
+ * and the network is left half updated, so it must not
+ * be used.
+ ******************************************************
  */
-STATION* getCorrectStation(STATION* source, STATION* dest) {
+bool applyUpdateFile(NETWORK* n, char* fileName, char* message, size_t size) {
 
-  STATION *temp = NULL;
-  bool found = false;
-  int lineIndex, j;
+  char row[MAX_QUERY_LENGTH], problem[MAX_QUERY_LENGTH], first[2];
+  int rowNumber = 0;
+  FILE *file = fopen(fileName, "r");
 
-  for(int i=0; i<source->numOfTransferLines; i++) {
-    if(strcmp(source->transferLines[i], dest->lineName) == 0) {
-      found = true;
-      goto found;
-    }
+  if(file == NULL) {
+    snprintf(message, size, "%s file could not be opened", fileName);
+    return false;
   }
-  found:
-  if(found == true) {
-    lineIndex = getLineIndex(dest->lineName);
-    temp = line[lineIndex]->start;
-    while(strcmp(source->stationName, temp->stationName) !=0)
-      temp = temp->next;
-    return temp;
+  while(fgets(row, sizeof(row), file) != NULL) {
+    rowNumber++;
+    if(sscanf(row, "%1s", first) != 1 || first[0] == '#') continue; //Blank line or comment
+    if(!applyUpdate(n, row, problem, sizeof(problem))) {
+      snprintf(message, size, "Error on line %d of %s: %s", rowNumber, fileName, problem);
+      fclose(file);
+      return false;
+    }
   }
-  else return source;
+  fclose(file);
+  return true;
 }
 
 
 /*
- *************************************************
- * Read the stations from the file along with its 
- * properties and store it in the data strcuture.
- *************************************************
+ ******************************************************************
+ * Read a metro file and build the graph. The lines and stations
+ * are only needed while building, so they go in an arena of their
+ * own that is freed right after. The names go in the arena of the
+ * graph. Returns NULL with what is wrong written to message.
+ ******************************************************************
  */
-void readStationsFromFile(LINE* line[], TRANSFERSTATION* transferStations[]) {
+GRAPH* readGraph(char* fileName, STATS* s, char* message, size_t size) {
+  STAT_START(loadStart);
+  ARENA *arena = makeArena(s);
+  ARENA *parseArena = makeArena(s);
+  SYMBOLS *stationNames = makeSymbols(arena);
+  SYMBOLS *lineNames = makeSymbols(arena);
 
-  FILE *metro = fopen("metro.txt", "r");
-  if(metro == NULL) {
-    printf("\nmetro.txt file could not be opened\n");
-    exit(0);
+  LINE **line = readStationsFromFile(fileName, stationNames, lineNames, parseArena, message, size);
+  if(line == NULL) {
+    freeArena(parseArena);
+    freeArena(arena);
+    return NULL;
   }
+  GRAPH *g = buildGraph(line, stationNames, lineNames, arena);
+  freeArena(parseArena);
+  STAT_STOP(s, PHASE_LOAD, loadStart);
+  return g;
+}
 
-  int ch=0;
-  char *lineInfo = NULL, *lineName = NULL; 
-  char *blankLine = calloc(5, sizeof(char*));
-  int numOfStations = 0;
-  char *stationInfo = NULL, *stationName = NULL;
-  int numOfTransferLines = 0, stopTime = 0, timeToReach = 0;
-  char** transferLines = NULL;
-  int transferTimes[4];
-  STATION *station = NULL;
-  int k=0, n=0, x=0, y=0;
-  char *tempTransferLines[8];
-  char *temp = NULL;
-  bool sourceFound=false, destFound=false;
-
-  //Store the stations in each line
-  for(int i=0; i<NUM_OF_LINES; i++) {
-    lineInfo = (char*) malloc(20);
-    lineName = (char*) malloc(10);
-    memset(transferTimes, 0, sizeof(transferTimes));
-    fgets(lineInfo,20,metro);
-    sscanf(lineInfo, "%s (%d)", lineName, &numOfStations);
-    line[i] = makeLine();
-
-    // Store all the stations in this line
-    for(int j=0;j<numOfStations;j++) {
-      transferLines = (char**) malloc(sizeof(char) * 4);
-      stationInfo = (char*) malloc(100);
-      stationName = (char*) malloc(30);
-      numOfTransferLines = 0;
-      fgets(stationInfo,100,metro);
-      sscanf(stationInfo,"%s %d %d %d", stationName, &numOfTransferLines, &timeToReach, &stopTime);
-      temp = strtok (stationInfo," ");
-      n=0;
-      if(numOfTransferLines != 0) {
-         while (temp != NULL && n<(4+(numOfTransferLines*2)))  
-  	 {
-         //At transfer stations, there are 4 strings of station name, transfers, time from first stop, stop time. If there is 1 transfer, then there are 2 
-         //more strings - transfer line and transfer time. If there is 2 transfers, then there are 4 more strings and so on.
-           if(n>=4)
-             tempTransferLines[n-4] = temp;
-           temp = strtok(NULL, " ");
-           n++;
-         }
-        x=0, y=0;
-        // Store the transfer lines and the transfer times in their respective arrays.
-        for(n=0;n<(numOfTransferLines*2);n++) {
-          if(n%2 == 0) { transferLines[x] = tempTransferLines[n]; x++; } 
-          else { transferTimes[y] = atoi(tempTransferLines[n]); y++; }
-        }
-      }
-      //Create the structure object and insert it in the list.
-      station = insertStationInLine(line[i], lineName, stationName, j+1, numOfTransferLines, timeToReach, stopTime, transferLines, transferTimes);
 
-      //Store only the main transfer stations in the transferStation array
-      if(numOfTransferLines != 0 && isStationValidTransferStation(stationName)) {
-         transferStations[k++] = makeTransferStation(station, stationName, lineName);
-      }
+/*
+ ******************************************************************
+ * Get the graph from the network image if one is given, otherwise
+ * read the metro file (metro.txt by default) and build it. A kiosk
+ * build has no default metro file and uses the network compiled in.
+ * Returns NULL with what is wrong written to message.
+ ******************************************************************
+ */
+GRAPH* loadGraph(char* metroFile, char* networkFile, STATS* s, char* message, size_t size) {
+  if(networkFile != NULL) return loadNetworkImage(networkFile, s, message, size);
+#ifdef EMBEDDED_NETWORK
+  if(metroFile == NULL) return loadEmbeddedNetwork(s);
+#endif
+  return readGraph(metroFile, s, message, size);
+}
 
-      // Check if source and destination stations created are correct. If yes, then store their Station objects.
-      if((strcmp(stationName,sourceName) == 0) && sourceFound == false) {
-         sourceFound = true;
-         source = station;
-      }
-      if((strcmp(stationName,destinationName) == 0) && destFound == false) {
-         destFound = true;
-         destination = station;
-      }
-   }
-   fgets(blankLine, 5, metro); 
-  }
-  if(sourceFound == true && destFound == true) {
-    source = getCorrectStation(source,destination);
-  }
-  free(stationInfo);
-  free(stationName);
-  free(lineInfo);
-  free(transferLines);
-  free(blankLine);
-  free(lineName);
-  fclose(metro);
-  if(sourceFound == false || destFound == false) {
-    printf("\n Source or destination station not found. Please try again! \n\n");
-    exit(0);
-  }
+
+// Stop the program on a file that could not be loaded, before anything was answered
+void stopOnLoadError(char* message) {
+  printf("\n%s\n", message);
+  exit(0);
 }
 
 
 /*
- *****************************************************************
- * Get the direction in which the line traversal has to be done.
- *****************************************************************
+ ******************************************************
+ * Read the table, or the graph with the updates and
+ * the schedule or the hierarchy if one is given. The
+ * graph goes with a table when a metro or network
+ * file or updates are given, the updates go to both.
+ * With --cache a new, empty cache goes with them.
+ * The network is not published and its reference is
+ * the caller's. The load is counted to s. If a file
+ * cannot be loaded, what was read is freed and NULL
+ * returned with what is wrong written to message.
+ ******************************************************
  */
-int getDirection(STATION *source, STATION *dest) {
+NETWORK* readNetwork(char* tableFile, char* metroFile, char* networkFile, char* scheduleFile, char* hierarchyFile, char* updatesFile, STATS* s, char* message, size_t size) {
+  bool ok = true;
+  NETWORK *n = (NETWORK*) calloc(1, sizeof(NETWORK));
+  n->refs = 1;
+  if(tableFile == NULL || metroFile != NULL || networkFile != NULL || updatesFile != NULL) ok = (n->graph = loadGraph(metroFile, networkFile, s, message, size)) != NULL;
+  if(ok && tableFile != NULL) ok = (n->table = loadTable(n->graph, tableFile, s, message, size)) != NULL;
+  if(ok && updatesFile != NULL && n->graph != NULL) ok = applyUpdateFile(n, updatesFile, message, size);
+  if(ok && scheduleFile != NULL && n->graph != NULL) ok = (n->schedule = readSchedule(n->graph, scheduleFile, s, message, size)) != NULL;
+  if(ok && hierarchyFile != NULL && n->graph != NULL) ok = (n->hierarchy = loadHierarchy(n->graph, hierarchyFile, s, message, size)) != NULL;
+  if(!ok) {
+    freeLoadedNetwork(n);
+    free(n);
+    return NULL;
+  }
+  if(cacheEntries > 0) n->cache = makeCache(cacheEntries);
+  return n;
+}
 
-   int direction = 0; // 0 - towards end of line, 1 - towards start of line
+/*
+ ******************************************************
+ * Copy a network for an update. The graph arrays an
+ * update writes to, the changed flags of the hierarchy
+ * or the table and the cached answers are copied, the rest is
+ * shared with the base network, which the copy holds
+ * on to. The copy has one reference, the caller's.
+ ******************************************************
+ */
+NETWORK* copyNetwork(NETWORK* n) {
+  NETWORK *temp = NEW(NETWORK);
+  *temp = *n;
+  temp->base = n->base != NULL ? n->base : n;
+  temp->nameIndex = getNameIndex(temp->base); //Shared, so it must be made before
+  temp->refs = 1;
+  pthread_mutex_lock(&networkLock);
+  temp->base->refs++;
+  pthread_mutex_unlock(&networkLock);
+  if(n->graph != NULL) temp->graph = copyGraph(n->graph);
+  if(n->hierarchy != NULL) temp->hierarchy = copyHierarchy(n->hierarchy, n->graph->numOfStations);
+  if(n->cache != NULL) temp->cache = copyCache(n->cache);
+  if(n->tableChanged != NULL) temp->tableChanged = (unsigned char*) memcpy(malloc(n->graph->numOfStations), n->tableChanged, n->graph->numOfStations);
+  return temp;
+}
 
-   if(source->stationNumber > dest->stationNumber) {
-     direction = 1;
-   }
-   else if (source->stationNumber < dest->stationNumber) {
-     direction = 0;
-   }
-   return direction;
+// Load the network and publish it, or stop if one of the files is wrong
+void loadNetwork(char* tableFile, char* metroFile, char* networkFile, char* scheduleFile, char* hierarchyFile, char* updatesFile) {
+  char message[MAX_ERROR_LENGTH];
+  NETWORK *n = readNetwork(tableFile, metroFile, networkFile, scheduleFile, hierarchyFile, updatesFile, &stats, message, sizeof(message));
+  if(n == NULL) stopOnLoadError(message);
+  publishNetwork(n);
 }
 
+
 /*
- *****************************************************************
- * Get the transfer station on the current line.
- * Ex: If transfer has to be done at Ft Totten from green line to
- * red line, then this function will return the STATION object for
- * Ft Totten of green(current) line.
- *****************************************************************
+ ***********************************************************************
+ * Hot reload of the server (SIGHUP, or --watch when one of the network
+ * files is written). A thread reads the files again into a new NETWORK
+ * while the server goes on answering from the old one. A bad file makes
+ * the loaders give back what they read and return an error, and the
+ * server keeps the old network. When the thread is done it wakes the
+ * server up, and the server publishes the new network. A search still
+ * answering from the old one finishes on it, and the old one is freed
+ * with the last of them.
+ ***********************************************************************
  */
-STATION* getCurrentTransferStation(STATION* source, STATION* dest) {
-  STATION *temp = source;
-  bool found = false;
-  char* destLineColor = dest->lineName;
+typedef struct {
+  char* tableFile; //Files the network was loaded from, NULL if not given
+  char* metroFile;
+  char* networkFile;
+  char* scheduleFile;
+  char* hierarchyFile;
+  char* updatesFile;
+  int wakeFd; //Written to when the thread is done
+  pthread_t thread;
+  bool running;
+  bool again; //Asked for while running, start again when done
+  NETWORK* network; //Read by the thread, NULL if one of the files is wrong
+  char error[MAX_ERROR_LENGTH]; //What is wrong with it
+  STATS stats; //Of the thread, added to the global stats by the server when it is done
+  char** updates; //"update" lines of the clients, applied again to the new network
+  int numOfUpdates;
+  int maxUpdates;
+} RELOAD;
 
+RELOAD* reload = NULL; //Set by the server
 
-  // Search on both sides of the source station
+void* runReload(void* argument) {
+  RELOAD *r = (RELOAD*) argument;
+  char done = 'd';
+  r->network = readNetwork(r->tableFile, r->metroFile, r->networkFile, r->scheduleFile, r->hierarchyFile, r->updatesFile, &r->stats, r->error, sizeof(r->error));
+  if(write(r->wakeFd, &done, 1) != 1) perror("reload");
+  return NULL;
+}
 
-  while(temp->next != NULL && found == false) {
-    for(int i=0; i<temp->numOfTransferLines; i++) {
-      if(strcmp(temp->transferLines[i], destLineColor) == 0) {
-        found = true;
-        break;
-      }
-      if(found == true) break;
-    }
-    if(found == true) break;
-    temp = temp->next;
+// Start reading the network again unless it is being read already
+void startReload(RELOAD* r) {
+  if(r->running) {
+    r->again = true;
+    return;
   }
+  r->again = false;
+  if(r->tableFile == NULL && r->metroFile == NULL && r->networkFile == NULL) {
+    printf("The network is compiled in, there is nothing to reload\n");
+    fflush(stdout);
+    return;
+  }
+  printf("Reloading the network\n");
+  fflush(stdout);
+  r->running = true;
 
-  if(found == false) temp = source;
+  //The signals go to the server, a read of the thread must not be cut short by one
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  pthread_create(&r->thread, NULL, runReload, r);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
 
-  while(temp->prev != NULL && found == false) {
-    for(int i=0; i<temp->numOfTransferLines; i++) {
-      if(strcmp(temp->transferLines[i], destLineColor) == 0) {
-        found = true;
-        break;
-      }
-    }
-    if(found == true) break;
-    temp = temp->prev;
+// Keep an update a client applied, to apply it again to the network that replaces this one
+void keepUpdate(RELOAD* r, char* update) {
+  if(r->numOfUpdates == r->maxUpdates) {
+    r->maxUpdates = r->maxUpdates == 0 ? 16 : 2 * r->maxUpdates;
+    r->updates = (char**) realloc(r->updates, sizeof(char*) * r->maxUpdates);
   }
-  
-  if(found == true) return temp;
-  else return NULL;
+  r->updates[r->numOfUpdates] = (char*) malloc(strlen(update) + 1);
+  strcpy(r->updates[r->numOfUpdates++], update);
 }
 
-
 /*
- ************************************************
- * Get the transfer time at a transfer station
- ************************************************
+ *************************************************************
+ * Called by the server when the thread is done. Apply the
+ * updates of the clients to the new network and publish it.
+ *************************************************************
  */
-int getTransferTime(STATION* source, STATION* dest, char* destLineColor) {
-  
-  STATION* temp = getCurrentTransferStation(source,dest);
-  for(int i=0; i<temp->numOfTransferLines; i++) {
-    if(strcmp(temp->transferLines[i], destLineColor) == 0) 
-      return temp->transferTimes[i];
+void finishReload(RELOAD* r) {
+
+  pthread_join(r->thread, NULL);
+  r->running = false;
+  mergeStats(&stats, &r->stats);
+  memset(&r->stats, 0, sizeof(STATS));
+  if(r->network == NULL) {
+    printf("Reload failed, still answering from the old network: %s\n", r->error);
+    fflush(stdout);
+    if(r->again) startReload(r);
+    return;
+  }
+
+  NETWORK *n = r->network;
+  r->network = NULL;
+  getNameIndex(n); //Made before the next client, as at the start
+  //What the server allocates from now on, for the updates, is its own
+  if(n->graph != NULL) n->graph->arena->stats = &stats;
+  if(n->table != NULL) n->table->arena->stats = &stats;
+  if(n->schedule != NULL) n->schedule->arena->stats = &stats;
+  for(int u=0; u<r->numOfUpdates; u++) {
+    char message[MAX_QUERY_LENGTH];
+    if(n->graph == NULL || !applyUpdate(n, r->updates[u], message, sizeof(message)))
+      printf("Update dropped by the reload: %s\n", r->updates[u]);
+  }
+  publishNetwork(n);
+  printf("Reloaded the network\n");
+  fflush(stdout);
+  if(r->again) startReload(r);
+}
+
+// Watch the directories of the network files, so that a file written or moved in place is seen
+int watchNetworkFiles(RELOAD* r) {
+  char *files[] = {r->tableFile, r->metroFile, r->networkFile, r->scheduleFile, r->hierarchyFile, r->updatesFile};
+  int fd = inotify_init1(IN_NONBLOCK);
+  for(int f=0; fd != -1 && f<6; f++) {
+    if(files[f] == NULL) continue;
+    char directory[PATH_MAX];
+    char *slash = strrchr(files[f], '/');
+    snprintf(directory, sizeof(directory), "%.*s", slash == NULL ? 1 : (int) (slash - files[f]) + 1, slash == NULL ? "." : files[f]);
+    inotify_add_watch(fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO);
+  }
+  return fd;
+}
+
+// Read the events of the watch, true if one of them is a network file
+bool readWatchEvents(RELOAD* r, int fd) {
+  char *files[] = {r->tableFile, r->metroFile, r->networkFile, r->scheduleFile, r->hierarchyFile, r->updatesFile};
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  bool changed = false;
+  ssize_t length;
+  while((length = read(fd, buffer, sizeof(buffer))) > 0) {
+    for(char *next = buffer; next < buffer + length; next += sizeof(struct inotify_event) + ((struct inotify_event*) next)->len) {
+      struct inotify_event *event = (struct inotify_event*) next;
+      for(int f=0; f<6; f++) {
+        if(files[f] == NULL || event->len == 0) continue;
+        char *slash = strrchr(files[f], '/');
+        if(strcmp(event->name, slash == NULL ? files[f] : slash + 1) == 0) changed = true;
+      }
+    }
   }
-  return 0;
+  return changed;
 }
 
 
 /*
- ****************************************************
- * Get the total stop time between source and dest.
- ****************************************************
+ ***********************************************************************
+ * Query server. A client sends "source destination" lines over a Unix
+ * domain socket and gets back the same answers as --batch would write,
+ * each one ending with a blank line. Requests can be pipelined. One
+ * thread serves all the clients with epoll, since a query takes only
+ * microseconds once the network is in memory.
+ ***********************************************************************
  */
-int getStopTimes(STATION *source, STATION* dest) {
+typedef struct {
+  int fd;
+  int lineNumber; //Queries answered on this connection, for the error lines
+  char in[MAX_QUERY_LENGTH]; //Partial request line
+  int inLength;
+  char *reply; //Answers not sent yet
+  size_t replyLength, replySent, replyCapacity;
+} CLIENT;
 
-  int totalStopTime = 0;
-  int direction = getDirection(source,dest);
-  STATION *temp = NULL;
+volatile sig_atomic_t stopServer = 0;
 
-  if(direction==0) temp = source->next;
-  else if(direction==1) temp = source->prev;
+void onStopSignal(int signal) {
+  (void) signal;
+  stopServer = 1;
+}
 
-  for(int i=0;i<abs(source->stationNumber - dest->stationNumber)-1; i++) {
-     if(direction == 0) {
-       totalStopTime+= temp->stopTime;
-       temp = temp->next;
-     }
-     else if(direction == 1) {
-       totalStopTime+= temp->stopTime;
-       temp = temp->prev;
-     }
+int wakeFd = -1; //Write end of the pipe that wakes the server up for a reload
+
+void onReloadSignal(int signal) {
+  char request = 'r';
+  (void) signal;
+  if(write(wakeFd, &request, 1) != 1) return;
+}
+
+// Add text to the answers waiting to be sent to a client
+void appendReply(CLIENT* client, char* text, size_t length) {
+  if(client->replyLength + length > client->replyCapacity) {
+    client->replyCapacity = 2*(client->replyLength + length);
+    client->reply = (char*) realloc(client->reply, client->replyCapacity);
+    if(client->reply == NULL) {
+      printf("\nOut of memory\n");
+      exit(0);
+    }
   }
-  return totalStopTime;
+  memcpy(client->reply + client->replyLength, text, length);
+  client->replyLength += length;
 }
 
 /*
- *****************************************************************************
- * Get the index of the transfer station from the array of transfer stations.
- *****************************************************************************
+ *************************************************************
+ * Send as much of the waiting answers as the socket takes.
+ * Returns false if the client has gone away.
+ *************************************************************
  */
-int getTransferStationIndex(char* stationName, char* lineName) {
-  int i=0;
-  for(i=0; i<25; i++) {
-    if((strcmp(transferStations[i]->stationName, stationName) == 0) && (strcmp(transferStations[i]->lineName, lineName) == 0)) 
-      goto found_index;
+bool sendReply(CLIENT* client) {
+  while(client->replySent < client->replyLength) {
+    ssize_t n = send(client->fd, client->reply + client->replySent, client->replyLength - client->replySent, MSG_NOSIGNAL);
+    if(n == -1) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    client->replySent += n;
   }
-  found_index:
-  return i;
+  client->replyLength = client->replySent = 0;
+  return true;
+}
+
+// Make the search of the server again if another network was published since it was made
+SEARCH* refreshSearch(SEARCH* search) {
+  if(search->network == network) return search;
+  FILE *output = search->output;
+  freeQuerySearch(search);
+  search = makeQuerySearch();
+  search->output = output;
+  return search;
 }
 
 /*
- *******************************************************
- * Get the station to which the transfer has to made.
- *******************************************************
+ *************************************************************
+ * Read what a client sent and answer every complete line.
+ * The answers are written to a memory stream and copied to
+ * the reply of the client. Returns false when the client has
+ * closed the connection or sent a line that is too long.
+ *************************************************************
  */
-STATION* getTransferStation(STATION* source, STATION* dest) {
+bool readRequests(CLIENT* client, SEARCH** current, char** answer, size_t* answerLength) {
+  for(;;) {
+    ssize_t n = recv(client->fd, client->in + client->inLength, sizeof(client->in) - 1 - client->inLength, 0);
+    if(n == 0) return false;
+    if(n == -1) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    client->inLength += n;
 
-  STATION *temp = NULL;
-  STATION *transferStation;
-  int transferStationIndex = 0;
-  char* destLineColor = dest->lineName;
-  
-  temp = getCurrentTransferStation(source,dest);
-  if(temp != NULL) {
-    transferStationIndex =  getTransferStationIndex(temp->stationName, destLineColor);
-    transferStation = transferStations[transferStationIndex]->station;
+    char *start = client->in, *end = client->in + client->inLength, *newline;
+    while((newline = memchr(start, '\n', end - start)) != NULL) {
+      SEARCH *search = *current = refreshSearch(*current);
+      *newline = '\0';
+      fseeko(search->output, 0, SEEK_SET);
+      if(strncmp(start, "update ", 7) == 0) {
+        char message[MAX_QUERY_LENGTH];
+        bool applied = false;
+        //The reload thread reads the update file into the new network, it must not meet a client update
+        if(network->graph == NULL) snprintf(message, sizeof(message), "a table is updated through its graph, serve it with --metro or --network");
+        else if(reload != NULL && reload->running) snprintf(message, sizeof(message), "the network is being reloaded, send the update again");
+        else {
+          NETWORK *next = copyNetwork(network);
+          if((applied = applyUpdate(next, start + 7, message, sizeof(message)))) publishNetwork(next);
+          else releaseNetwork(next);
+          if(applied && reload != NULL) keepUpdate(reload, start + 7);
+        }
+        fprintf(search->output, "%s on line %d: %s\n\n", applied ? "Updated" : "Error", ++client->lineNumber, message);
+        fflush(search->output);
+        appendReply(client, *answer, *answerLength);
+      }
+      else if(answerQueryLine(search, start, client->lineNumber + 1)) {
+        client->lineNumber++;
+        fflush(search->output);
+        appendReply(client, *answer, *answerLength);
+      }
+      start = newline + 1;
+    }
+    client->inLength = end - start;
+    memmove(client->in, start, client->inLength);
+    if(client->inLength == sizeof(client->in) - 1) return false; //No newline in a whole buffer
   }
-  return transferStation;
+}
+
+// Close a connection and free its buffers
+void closeClient(CLIENT* client) {
+  close(client->fd);
+  free(client->reply);
+  free(client);
 }
 
 /*
- ***************************************************************
- * Display the final path to take and also store it in the file.
- ***************************************************************
+ ***********************************************************************
+ * Serve queries on the socket until SIGINT or SIGTERM. The network is
+ * loaded by the caller and stays in memory for all the clients, until
+ * SIGHUP or, with watch, a change of its files reloads it.
+ ***********************************************************************
  */
-void displayPathAndWriteToFile(int sourceLineIndex, int destLineIndex, STATION *source, STATION * dest, STATION *transferStation, int numberOfStationsCurrentLine, int numberOfStationsTransferLine, STATION* currentTransferStation) {
+void runServer(char* socketPath, RELOAD* r, bool watch) {
 
-  int stopTime=0, totalTimeMin=0, totalTimeSec=0, transferTime=0; 
-  char *towards1, *towards2; //Station name towards which the train is headed.
+  struct sockaddr_un address;
+  struct epoll_event event, events[MAX_EVENTS];
+  struct sigaction action;
+  char *answer = NULL;
+  size_t answerLength = 0;
 
-  //No transfer required
-  if(transferStation == NULL) {
-    if(source->stationNumber > dest->stationNumber)
-      towards1 = line[sourceLineIndex]->start->stationName;
-    else if (source->stationNumber < dest->stationNumber) 
-      towards1 = line[sourceLineIndex]->end->stationName;
+  if(strlen(socketPath) >= sizeof(address.sun_path)) {
+    printf("\nSocket path %s is too long\n", socketPath);
+    exit(0);
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socketPath);
 
-    stopTime = getStopTimes(source,dest);
-    totalTimeMin = (stopTime + abs(source->timeToReach - dest->timeToReach))/60;
-    totalTimeSec = (stopTime + abs(source->timeToReach - dest->timeToReach))%60;
+  int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  unlink(socketPath);
+  if(listener == -1 || bind(listener, (struct sockaddr*) &address, sizeof(address)) == -1 || listen(listener, SOMAXCONN) == -1) {
+    printf("\nCould not listen on %s\n", socketPath);
+    exit(0);
+  }
 
-    fprintf(out, "Start from %s station on %s line towards %s for %d stations to arrive at %s.\nTotal duration of journey: %d minutes %d seconds\n", source->stationName, source->lineName, towards1, numberOfStationsCurrentLine, dest->stationName, totalTimeMin, totalTimeSec);
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = onStopSignal;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
 
-    printf("\nStart from %s station on %s line towards %s for %d stations to arrive at %s.", source->stationName, source->lineName, towards1, numberOfStationsCurrentLine, dest->stationName);
-    printf("\nTotal duration of journey: %d minutes %d seconds\n\n", totalTimeMin, totalTimeSec);
+  //SIGHUP and the reload thread write to the wake pipe
+  int wake[2], watchFd = -1;
+  if(pipe(wake) == -1) {
+    printf("\nCould not make the reload pipe\n");
+    exit(0);
   }
+  fcntl(wake[0], F_SETFL, O_NONBLOCK);
+  wakeFd = r->wakeFd = wake[1];
+  reload = r;
+  action.sa_handler = onReloadSignal;
+  action.sa_flags = SA_RESTART;
+  sigaction(SIGHUP, &action, NULL);
 
-  //Transfer required
-  else {
-    if(source->stationNumber > currentTransferStation->stationNumber)
-      towards1 = line[sourceLineIndex]->start->stationName;
-    else if (source->stationNumber < currentTransferStation->stationNumber)
-      towards1 = line[sourceLineIndex]->end->stationName;
-
-    if(transferStation->stationNumber > dest->stationNumber)
-      towards2 = line[destLineIndex]->start->stationName;
-    else if(transferStation->stationNumber <= dest->stationNumber)
-      towards2 = line[destLineIndex]->end->stationName;
-
-    stopTime = getStopTimes(source,currentTransferStation);
-    stopTime+= getStopTimes(transferStation, dest);
-    transferTime = getTransferTime(source, dest, dest->lineName);
-
-    //If the destination is sae as transfer station, then no need to consider the transfer or transfer time
-    if(numberOfStationsTransferLine == 0 && (strcmp(transferStation->stationName, dest->stationName)==0)) {
-      totalTimeMin = (stopTime + abs(currentTransferStation->timeToReach - source->timeToReach) + abs(transferStation->timeToReach - dest->timeToReach))/60;
-      totalTimeSec = (stopTime + abs(currentTransferStation->timeToReach - source->timeToReach) + abs(transferStation->timeToReach - dest->timeToReach))%60;
-
-    fprintf(out, "Start from %s station on %s line towards %s for %d stations to reach %s.\nTotal duration of journey: %d minutes %d seconds.", source->stationName, source->lineName, towards1, numberOfStationsCurrentLine, currentTransferStation->stationName, totalTimeMin, totalTimeSec);
-
-    printf("\nStart from %s station on %s line towards %s for %d stations to reach %s.", source->stationName, source->lineName, towards1, numberOfStationsCurrentLine, currentTransferStation->stationName);
-    printf("\nTotal duration of journey: %d minutes %d seconds\n\n", totalTimeMin, totalTimeSec);
-    }
-
-    // Consider the transfer and transfer time
-    else{
-      totalTimeMin = (stopTime + abs(currentTransferStation->timeToReach - source->timeToReach) + transferTime + abs(transferStation->timeToReach - dest->timeToReach))/60;
-      totalTimeSec = (stopTime + abs(currentTransferStation->timeToReach - source->timeToReach) + transferTime + abs(transferStation->timeToReach - dest->timeToReach))%60;
-    
-      fprintf(out, "Start from %s station on %s line towards %s for %d stations to reach %s.\nTransfer to %s line.\nTake %s line towards %s for %d stations to reach %s.\nTotal duration of journey: %d minutes %d seconds.", source->stationName, source->lineName, towards1, numberOfStationsCurrentLine, currentTransferStation->stationName, transferStation->lineName, transferStation->lineName, towards2, numberOfStationsTransferLine, dest->stationName, totalTimeMin, totalTimeSec);
-
-      printf("\nStart from %s station on %s line towards %s for %d stations to reach %s.", source->stationName, source->lineName, towards1, numberOfStationsCurrentLine, currentTransferStation->stationName);
-      printf("\nTransfer to %s line.", transferStation->lineName);
-      printf("\nTake %s line towards %s for %d stations to reach %s", transferStation->lineName, towards2, numberOfStationsTransferLine, dest->stationName);
-     printf("\nTotal duration of journey: %d minutes %d seconds\n\n", totalTimeMin, totalTimeSec);
-   }
+  //All the answers are written to this memory stream and then copied to the client
+  SEARCH *search = makeQuerySearch();
+  search->output = open_memstream(&answer, &answerLength);
+
+  int epoll = epoll_create1(0);
+  event.events = EPOLLIN;
+  event.data.ptr = NULL; //The listener
+  epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &event);
+  event.data.ptr = wake; //The wake pipe
+  epoll_ctl(epoll, EPOLL_CTL_ADD, wake[0], &event);
+  if(watch && (watchFd = watchNetworkFiles(r)) != -1) {
+    event.data.ptr = &watchFd; //The watch
+    epoll_ctl(epoll, EPOLL_CTL_ADD, watchFd, &event);
+  }
+  printf("\nServing queries on %s\n", socketPath);
+  fflush(stdout);
+
+  while(!stopServer) {
+    int numOfEvents = epoll_wait(epoll, events, MAX_EVENTS, -1);
+    for(int i=0; i<numOfEvents; i++) {
+      CLIENT *client = (CLIENT*) events[i].data.ptr;
+
+      //New connections
+      if(client == NULL) {
+        int fd;
+        while((fd = accept(listener, NULL, NULL)) != -1) {
+          fcntl(fd, F_SETFL, O_NONBLOCK);
+          client = (CLIENT*) calloc(1, sizeof(CLIENT));
+          client->fd = fd;
+          if(outputFormat == FORMAT_CSV) appendReply(client, CSV_HEADER, strlen(CSV_HEADER)); //Every connection is a CSV of its own
+          event.events = EPOLLIN;
+          event.data.ptr = client;
+          epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event);
+        }
+        continue;
+      }
+
+      //Reload requests, and the reload thread when it is done
+      if(events[i].data.ptr == wake) {
+        char request;
+        bool pending = false;
+        while(read(wake[0], &request, 1) == 1) {
+          if(request == 'd') finishReload(r);
+          else pending = true;
+        }
+        if(pending) startReload(r);
+        continue;
+      }
+      if(events[i].data.ptr == &watchFd) {
+        if(readWatchEvents(r, watchFd)) startReload(r);
+        continue;
+      }
+
+      bool open = true;
+      if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        open = readRequests(client, &search, &answer, &answerLength);
+      if(open) open = sendReply(client);
+      if(!open) {
+        closeClient(client);
+        continue;
+      }
+
+      //Wait for the socket to drain if the answers did not all fit
+      event.events = client->replyLength > 0 ? EPOLLIN | EPOLLOUT : EPOLLIN;
+      event.data.ptr = client;
+      epoll_ctl(epoll, EPOLL_CTL_MOD, client->fd, &event);
+    }
+  }
+
+  if(r->running) {
+    pthread_join(r->thread, NULL);
+    if(r->network != NULL) releaseNetwork(r->network);
   }
+  for(int u=0; u<r->numOfUpdates; u++) free(r->updates[u]);
+  free(r->updates);
+  reload = NULL;
+  close(epoll);
+  close(listener);
+  close(wake[0]);
+  close(wake[1]);
+  if(watchFd != -1) close(watchFd);
+  unlink(socketPath);
+  fclose(search->output);
+  freeQuerySearch(search);
+  free(answer);
+  printf("\nServer on %s stopped\n", socketPath);
 }
 
- 
+
 /*
- ******************************************************
- * Find the path and write to the file.
- ******************************************************
+ ***********************************************************************
+ * Load test client. Send the queries of the file to a server one at a
+ * time, write the answers to the output file and print the latency of
+ * the queries as seen by the client.
+ ***********************************************************************
  */
-void findPathAndWriteToFile(STATION *source, STATION* dest) {
-  
-  int sourceLineIndex = getLineIndex(source->lineName); 
-  int destLineIndex = getLineIndex(dest->lineName); 
-  int numberOfStationsCurrentLine = 0, numberOfStationsTransferLine = 0; //Number of stations to be considered in the path from source line and dest line.
-  STATION *transferStation = NULL; //Transfer station on destination line
-  STATION *currentTransferStation = NULL; //Transfer station on source line. Station name will be same as the above, but lineName will be diffrent
+void runClient(char* socketPath, FILE* queries) {
 
-  //If source and destination is on same line
-  if(strcmp(source->lineName, dest->lineName) == 0) {
-    numberOfStationsCurrentLine = abs(dest->stationNumber - source->stationNumber);
-    displayPathAndWriteToFile(sourceLineIndex, destLineIndex, source, dest, transferStation, numberOfStationsCurrentLine, numberOfStationsTransferLine, currentTransferStation);
+  struct sockaddr_un address;
+  char query[MAX_QUERY_LENGTH], buffer[4096];
+  int numOfQueries = 0, maxQueries = 1024;
+  double *latency = (double*) malloc(sizeof(double) * maxQueries);
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd == -1 || connect(fd, (struct sockaddr*) &address, sizeof(address)) == -1) {
+    printf("\nCould not connect to %s\n", socketPath);
+    exit(0);
   }
 
-  // source and destination on different line
-  else {
-     currentTransferStation = getCurrentTransferStation(source, dest);
-     transferStation = getTransferStation(source, dest);
-     numberOfStationsCurrentLine = abs(currentTransferStation->stationNumber - source->stationNumber);
-     numberOfStationsTransferLine = abs(transferStation->stationNumber - dest->stationNumber);
-     displayPathAndWriteToFile(sourceLineIndex, destLineIndex, source, dest, transferStation, numberOfStationsCurrentLine, numberOfStationsTransferLine, currentTransferStation);
+  while(fgets(query, sizeof(query), queries) != NULL) {
+    char first[2];
+    if(sscanf(query, "%1s", first) != 1 || first[0] == '#') continue; //The server does not answer these
+    size_t length = strlen(query);
+    if(query[length-1] != '\n') query[length++] = '\n';
+
+    double sent = getMicroseconds();
+    if(send(fd, query, length, MSG_NOSIGNAL) != (ssize_t) length) break;
+
+    //An answer ends with a blank line
+    int last = 0; //Newlines at the end of what was read so far
+    while(last < 2) {
+      ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+      if(n <= 0) {
+        printf("\nServer on %s closed the connection\n", socketPath);
+        exit(0);
+      }
+      fwrite(buffer, 1, n, out);
+      for(ssize_t k=0; k<n; k++) last = buffer[k] == '\n' ? last + 1 : 0;
+    }
+
+    if(numOfQueries == maxQueries) {
+      maxQueries *= 2;
+      latency = (double*) realloc(latency, sizeof(double) * maxQueries);
+    }
+    latency[numOfQueries++] = getMicroseconds() - sent;
+  }
+  close(fd);
+
+  if(numOfQueries > 0) {
+    FILE *report = out == stdout ? stderr : stdout;
+    qsort(latency, numOfQueries, sizeof(double), compareLatency);
+    fprintf(report, "\n%d queries. Latency in microseconds: p50 %.1f, p99 %.1f, max %.1f\n", numOfQueries,
+      latency[numOfQueries/2], latency[(int) (numOfQueries*0.99)], latency[numOfQueries-1]);
   }
+  free(latency);
 }
 
 
@@ -587,38 +6030,327 @@ void displayLine(LINE* line) {
 }
 
 
+// Read a station name typed at the prompt. It is looked up as typed, then in the name index where spaces match '_'.
+void readStationName(char* name, int size) {
+  if(fgets(name, size, stdin) == NULL) name[0] = '\0';
+  name[strcspn(name, "\r\n")] = '\0';
+}
+
+void printUsage() {
+  printf("\nThe usage is: a.out [--network network_file | --table table_file] output_file\n");
+  printf("              a.out [--network network_file | --table table_file] [--threads n] --batch queries_file output_file\n");
+  printf("              a.out [options] --format text|json|csv|binary [--batch queries_file | --serve socket_path] output_file\n");
+  printf("              a.out [--network network_file] --precompute table_file\n");
+  printf("              a.out --compile metro_file -o network_file\n");
+  printf("              a.out --embed metro_file -o source_file\n");
+  printf("              a.out [--network network_file | --table table_file] --serve socket_path [--watch]\n");
+  printf("              a.out --client socket_path --batch queries_file output_file\n");
+  printf("              a.out [--network network_file | --table table_file] [--threads n] --bench queries_file\n");
+  printf("              a.out [--network network_file] --schedule schedule_file [--batch queries_file] output_file\n");
+  printf("              a.out [--network network_file] --contract hierarchy_file\n");
+  printf("              a.out [options] --cache entries [--batch queries_file | --serve socket_path] ...\n");
+  printf("              a.out [--network network_file] --updates delta_file [options] ...\n");
+  printf("              a.out [--network network_file | --table table_file] --isochrone source[,source...] [--cutoff minutes] [--binary] output_file\n");
+  printf("              a.out [--network network_file | --table table_file] [--threads n] --matrix [--binary] output_file\n");
+  printf("              a.out [--network network_file] --alternatives k [--batch queries_file | --serve socket_path] ...\n");
+  printf("              a.out [--network network_file] --pareto [--batch queries_file | --serve socket_path] ...\n");
+  printf("              a.out [--network network_file] --hierarchy hierarchy_file [--batch queries_file] output_file\n");
+  printf("\nqueries_file has one \"source destination\" pair per line. Use - to read the queries from stdin");
+  printf("\nor to write the output to stdout. --threads sets how many threads answer a batch, all the cores");
+  printf("\nby default. --precompute stores the routes between all the stations in table_file and --table");
+  printf("\nanswers from that file without reading metro.txt. --compile writes the network as a binary image");
+  printf("\nthat --network maps in place of reading metro.txt. --serve keeps the network loaded and answers");
+  printf("\nqueries sent to socket_path, --client sends the queries to it. --bench prints the load time, the");
+  printf("\nlatency of the queries one by one, the batch throughput and the peak RSS. --metro metro_file reads");
+  printf("\nanother file in place of metro.txt. --stats writes the phase times and counters as JSON to stderr.");
+  printf("\n--schedule schedule_file answers from the timetable: every query then needs a departure time, as");
+  printf("\n\"source destination HH:MM\", and gets the earliest arrival with the time of every train. --contract");
+  printf("\nstores a contraction hierarchy of the network in hierarchy_file and --hierarchy answers with it.");
+  printf("\n--cache keeps the itineraries of the last queries, up to entries of them, and answers a repeated");
+  printf("\nquery from it without routing. --updates applies the closures and time changes of delta_file to the");
+  printf("\nnetwork after loading it. The server also takes \"update ...\" lines with the same changes. An");
+  printf("\nupdate that can make a trip faster drops --hierarchy and --table. A table server takes update lines");
+  printf("\nwith --metro, --network or --updates, which read the graph too. --schedule cannot be updated.");
+  printf("\n--isochrone writes the time from the nearest source to every station as \"station,seconds\" rows,");
+  printf("\nor as raw ints with --binary, -1 for the stations not reached within --cutoff minutes. --matrix");
+  printf("\nwrites the times between all the stations, a row per source, the same way. --alternatives writes");
+  printf("\nthe k best routes without loops, up to %d, each with its number of transfers. --pareto writes", MAX_ALTERNATIVES);
+  printf("\nthe fastest route, then every slower route that has fewer transfers than all the faster ones.");
+  printf("\nStation names are matched without case, '_' or a space alike, and a name that is the start of one");
+  printf("\nstation or a typo of one is taken for it. A \"complete text\" or \"match text\" query line lists the");
+  printf("\nstations that start with text or are close to it. --embed writes the network as C tables for");
+  printf("\n\"make metroKiosk\", a build that routes from them and reads metro_file only when --metro is given.");
+  printf("\nThe server reloads the network files on SIGHUP, and with --watch whenever one of them is written.");
+  printf("\n--format writes the itineraries as JSON Lines, CSV rows or binary records instead of text.\n");
+}
+
+
 int main(int argc, char *argv[]) {
 
-   if(argc != 2) {
+   char *batchFile = NULL, *outputFile = NULL, *tableFile = NULL, *precomputeFile = NULL;
+   char *compileFile = NULL, *embedFile = NULL, *networkFile = NULL, *imageFile = NULL, *serveSocket = NULL, *clientSocket = NULL;
+   char *metroFile = NULL, *benchFile = NULL, *scheduleFile = NULL, *contractFile = NULL, *hierarchyFile = NULL;
+   char *updatesFile = NULL, *isochroneSources = NULL, message[MAX_ERROR_LENGTH];
+   bool binary = false, matrix = false, watch = false;
+   int cutoff = INT_MAX;
+   SEARCH *search = NULL;
+   int numOfThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+   for(int i=1; i<argc; i++) {
+     if(strcmp(argv[i], "--batch") == 0 && i+1 < argc) batchFile = argv[++i];
+     else if(strcmp(argv[i], "--table") == 0 && i+1 < argc) tableFile = argv[++i];
+     else if(strcmp(argv[i], "--precompute") == 0 && i+1 < argc) precomputeFile = argv[++i];
+     else if(strcmp(argv[i], "--compile") == 0 && i+1 < argc) compileFile = argv[++i];
+     else if(strcmp(argv[i], "--embed") == 0 && i+1 < argc) embedFile = argv[++i];
+     else if(strcmp(argv[i], "-o") == 0 && i+1 < argc) imageFile = argv[++i];
+     else if(strcmp(argv[i], "--network") == 0 && i+1 < argc) networkFile = argv[++i];
+     else if(strcmp(argv[i], "--serve") == 0 && i+1 < argc) serveSocket = argv[++i];
+     else if(strcmp(argv[i], "--client") == 0 && i+1 < argc) clientSocket = argv[++i];
+     else if(strcmp(argv[i], "--threads") == 0 && i+1 < argc) numOfThreads = atoi(argv[++i]);
+     else if(strcmp(argv[i], "--metro") == 0 && i+1 < argc) metroFile = argv[++i];
+     else if(strcmp(argv[i], "--bench") == 0 && i+1 < argc) benchFile = argv[++i];
+     else if(strcmp(argv[i], "--schedule") == 0 && i+1 < argc) scheduleFile = argv[++i];
+     else if(strcmp(argv[i], "--contract") == 0 && i+1 < argc) contractFile = argv[++i];
+     else if(strcmp(argv[i], "--hierarchy") == 0 && i+1 < argc) hierarchyFile = argv[++i];
+     else if(strcmp(argv[i], "--cache") == 0 && i+1 < argc) cacheEntries = atoi(argv[++i]);
+     else if(strcmp(argv[i], "--updates") == 0 && i+1 < argc) updatesFile = argv[++i];
+     else if(strcmp(argv[i], "--isochrone") == 0 && i+1 < argc) isochroneSources = argv[++i];
+     else if(strcmp(argv[i], "--cutoff") == 0 && i+1 < argc) cutoff = atoi(argv[++i]) * 60;
+     else if(strcmp(argv[i], "--binary") == 0) binary = true;
+     else if(strcmp(argv[i], "--matrix") == 0) matrix = true;
+     else if(strcmp(argv[i], "--alternatives") == 0 && i+1 < argc) numOfAlternatives = atoi(argv[++i]);
+     else if(strcmp(argv[i], "--pareto") == 0) pareto = true;
+     else if(strcmp(argv[i], "--watch") == 0) watch = true;
+     else if(strcmp(argv[i], "--format") == 0 && i+1 < argc) outputFormat = parseFormat(argv[++i]);
+     else if(strcmp(argv[i], "--stats") == 0) atexit(writeStatsOnExit);
+     else if(outputFile == NULL) outputFile = argv[i];
+     else { outputFile = NULL; break; }
+   }
+
+   //A table is answered from without the graph, it is read with one only to be updated
+   if(metroFile == NULL && (tableFile == NULL || updatesFile != NULL)) metroFile = DEFAULT_METRO_FILE;
+
+   if(scheduleFile != NULL && tableFile != NULL) {
+     printf("\nA schedule needs the graph, it cannot be used with --table\n");
+     exit(0);
+   }
+   if(hierarchyFile != NULL && (tableFile != NULL || scheduleFile != NULL)) {
+     printf("\nA hierarchy cannot be used with --table or --schedule\n");
+     exit(0);
+   }
+   if(outputFormat == -1) {
+     printf("\n--format takes text, json, csv or binary\n");
+     exit(0);
+   }
+   if(outputFormat == FORMAT_BINARY && serveSocket != NULL) {
+     printf("\nThe server answers in text, json or csv, binary records need --batch\n");
+     exit(0);
+   }
+   binary = binary || outputFormat == FORMAT_BINARY;
+   if(numOfAlternatives < 1 || numOfAlternatives > MAX_ALTERNATIVES) {
+     printf("\n--alternatives takes 1 to %d routes\n", MAX_ALTERNATIVES);
+     exit(0);
+   }
+   if((numOfAlternatives > 1 || pareto) && (tableFile != NULL || scheduleFile != NULL || hierarchyFile != NULL)) {
+     printf("\n%s the graph, they cannot be used with --table, --schedule or --hierarchy\n", pareto ? "Pareto routes search" : "Alternatives search");
+     exit(0);
+   }
+   if(numOfAlternatives > 1 && pareto) {
+     printf("\nUse either --alternatives or --pareto\n");
+     exit(0);
+   }
+   if(updatesFile != NULL && scheduleFile != NULL) {
+     printf("\nUpdates patch the graph, they cannot be used with --schedule\n");
+     exit(0);
+   }
+
+   //Compile mode. Write the network image and exit.
+   if(compileFile != NULL && imageFile != NULL) {
+     if((graph = readGraph(compileFile, &stats, message, sizeof(message))) == NULL) stopOnLoadError(message);
+     writeNetworkImage(graph, imageFile);
+     printf("\nNetwork image written to %s\n", imageFile);
+     freeGraph(graph);
+     return 0;
+   }
+
+   //Embed mode. Write the network as the C tables of a kiosk build and exit.
+   if(embedFile != NULL && imageFile != NULL) {
+     if((graph = readGraph(embedFile, &stats, message, sizeof(message))) == NULL) stopOnLoadError(message);
+     writeEmbeddedNetwork(graph, embedFile, imageFile);
+     printf("\nNetwork source written to %s\n", imageFile);
+     freeGraph(graph);
+     return 0;
+   }
+
+   //Precompute mode. Write the table and exit.
+   if(precomputeFile != NULL) {
+     loadNetwork(NULL, metroFile, networkFile, NULL, NULL, updatesFile);
+     precomputeTable(graph, precomputeFile);
+     printf("\nTable of all the routes written to %s\n", precomputeFile);
+     freeNetwork();
+     return 0;
+   }
+
+   //Contract mode. Write the hierarchy and exit.
+   if(contractFile != NULL) {
+     loadNetwork(NULL, metroFile, networkFile, NULL, NULL, updatesFile);
+     contractGraph(graph, contractFile);
+     printf("Contraction hierarchy written to %s\n", contractFile);
+     freeNetwork();
+     return 0;
+   }
+
+   //Benchmark mode. Time the load, the queries one by one and the threaded batch.
+   if(benchFile != NULL) {
+     FILE *queries = fopen(benchFile, "r");
+     if(queries == NULL) {
+       printf("\n%s file could not be opened\n", benchFile);
+       exit(0);
+     }
+     double start = getMicroseconds();
+     loadNetwork(tableFile, metroFile, networkFile, scheduleFile, hierarchyFile, updatesFile);
+     double loadTime = getMicroseconds() - start;
+     getNameIndex(network); //Made before the queries are timed, as the server does
+
+     char *name = tableFile != NULL ? tableFile : hierarchyFile != NULL ? hierarchyFile : networkFile != NULL ? networkFile : metroFile;
+     if(name == NULL) name = "compiled in network";
+     runBenchmark(name, queries, numOfThreads, loadTime);
+     fclose(queries);
+     freeNetwork();
+     return 0;
+   }
+
+   //Server mode. Load the network once and answer queries until stopped.
+   if(serveSocket != NULL) {
+     RELOAD reload;
+     memset(&reload, 0, sizeof(reload));
+     reload.tableFile = tableFile;
+     reload.metroFile = metroFile;
+     reload.networkFile = networkFile;
+     reload.scheduleFile = scheduleFile;
+     reload.hierarchyFile = hierarchyFile;
+     reload.updatesFile = updatesFile;
+     loadNetwork(tableFile, metroFile, networkFile, scheduleFile, hierarchyFile, updatesFile);
+     getNameIndex(network); //Made before the first client, so that no answer waits for it
+     runServer(serveSocket, &reload, watch);
+     freeNetwork();
+     return 0;
+   }
+
+   if(outputFile == NULL || (clientSocket != NULL && batchFile == NULL)) {
      printf("\nWrong number of options provided for a.out\n");
-     printf("\nThe usage is: a.out output_file\n");
+     printUsage();
      exit(0);
    }
-   
-   sourceName = (char*) malloc(30);;
-   destinationName = (char*) malloc(30);;
-   printf("\nEnter the source station(case sensitive): ");
-   scanf("%s", sourceName);
-   printf("Enter the destination station(case sensitive): ");
-   scanf("%s", destinationName);
 
-   source = NULL;
-   destination = NULL;
+   //Isochrone and matrix modes. Write the times from the sources or from every station to every station.
+   if(isochroneSources != NULL || matrix) {
+     if(scheduleFile != NULL || hierarchyFile != NULL) {
+       printf("\n%s needs the graph or a table, it cannot be used with --schedule or --hierarchy\n", matrix ? "A matrix" : "An isochrone");
+       exit(0);
+     }
+     loadNetwork(tableFile, metroFile, networkFile, NULL, NULL, updatesFile);
+     if(matrix) writeTravelTimeMatrix(numOfThreads, binary, outputFile);
+     else writeTravelTimes(isochroneSources, cutoff, binary, outputFile);
+     freeNetwork();
+     return 0;
+   }
+
+   //Batch mode. Load the network once and answer all the queries.
+   if(batchFile != NULL) {
+     FILE *queries = strcmp(batchFile, "-") == 0 ? stdin : fopen(batchFile, "r");
+     if(queries == NULL) {
+       printf("\n%s file could not be opened\n", batchFile);
+       exit(0);
+     }
+     out = strcmp(outputFile, "-") == 0 ? stdout : fopen(outputFile, "w+");
+     if(out == NULL) {
+       printf("\n%s file could not be opened\n", outputFile);
+       exit(0);
+     }
+     setvbuf(out, NULL, _IOFBF, OUTPUT_BUFFER);
+
+     //Client mode. The server answers the queries.
+     if(clientSocket != NULL) {
+       runClient(clientSocket, queries);
+       if(queries != stdin) fclose(queries);
+       fclose(out);
+       return 0;
+     }
+
+     separateAnswers = outputFormat == FORMAT_TEXT;
+     writeRecordsHeader(out);
+     loadNetwork(tableFile, metroFile, networkFile, scheduleFile, hierarchyFile, updatesFile);
+
+     if(numOfThreads > 1) runParallelBatch(queries, numOfThreads);
+     else {
+       search = makeQuerySearch();
+       runBatch(queries, search);
+       freeQuerySearch(search);
+     }
+
+     if(queries != stdin) fclose(queries);
+     fclose(out);
+     freeNetwork();
+     return 0;
+   }
+
+   char sourceName[100], destinationName[100], time[16];
+   int departure = -1, result;
+   printf("\nEnter the source station: ");
+   readStationName(sourceName, sizeof(sourceName));
+   printf("Enter the destination station: ");
+   readStationName(destinationName, sizeof(destinationName));
+   if(scheduleFile != NULL) {
+     printf("Enter the departure time(HH:MM): ");
+     scanf("%15s", time);
+     if((departure = parseTime(time)) == -1) {
+       printf("\n%s is not a time of the day\n", time);
+       exit(0);
+     }
+   }
 
    if(strcmp(sourceName, destinationName) == 0) {
      printf("\nSource and destination is same!\n");
      exit(0);
    }
   
-   out = fopen(argv[1], "w+");
+   out = fopen(outputFile, "w+");
+   writeRecordsHeader(out);
 
-   //Array of transfer stations. Example: Fort Totten of green line is considered 1 transfer station and For Totten of red is considered as another.  
-   transferStations = (TRANSFERSTATION**) malloc(sizeof(TRANSFERSTATION) * 25);
-   readStationsFromFile(line, transferStations);
+   loadNetwork(tableFile, metroFile, networkFile, scheduleFile, hierarchyFile, updatesFile);
+   search = makeQuerySearch();
 
-   findPathAndWriteToFile(source, destination);
+   //The itinerary is rendered once, then written to the file and shown on the console
+   char *answer = NULL;
+   size_t answerLength = 0;
+   search->output = open_memstream(&answer, &answerLength);
+   result = answerQuery(search, sourceName, destinationName, departure);
+   fclose(search->output);
+   fwrite(answer, 1, answerLength, out);
+
+   switch(result) {
+     case QUERY_OK:
+       if(outputFormat != FORMAT_BINARY) printf("\n%s\n", answer);
+       break;
+     case QUERY_SOURCE_NOT_FOUND:
+     case QUERY_DESTINATION_NOT_FOUND:
+       printf("\n Source or destination station not found. Please try again! \n\n");
+       search->output = stdout;
+       writeNameMatches(search, result == QUERY_SOURCE_NOT_FOUND ? sourceName : destinationName, true, FORMAT_TEXT);
+       printf("\n");
+       break;
+     case QUERY_SAME_STATION:
+       printf("\nSource and destination is same!\n");
+       break;
+     case QUERY_NO_PATH:
+       printf("\nNo path found from %s to %s\n\n", sourceName, destinationName);
+       break;
+   }
   
-   free(transferStations);
    fclose(out);
+   free(answer);
+   freeQuerySearch(search);
+   freeNetwork();
    return 0;
 }